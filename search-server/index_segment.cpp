@@ -0,0 +1,92 @@
+#include "index_segment.h"
+
+#include <algorithm>
+#include <iterator>
+
+IndexSegment::IndexSegment(const std::map<std::string_view, std::map<int, double>>& word_to_document_freqs,
+                           int generation)
+    : first_generation_(generation)
+    , last_generation_(generation)
+{
+    offsets_.push_back(0);
+    for (const auto& [word, document_freqs] : word_to_document_freqs) {
+        if (document_freqs.empty()) {
+            continue;
+        }
+        words_.push_back(word);
+        for (const auto [document_id, term_freq] : document_freqs) {
+            postings_.push_back({document_id, term_freq});
+            document_ids_.push_back(document_id);
+        }
+        offsets_.push_back(postings_.size());
+    }
+    std::sort(document_ids_.begin(), document_ids_.end());
+    document_ids_.erase(std::unique(document_ids_.begin(), document_ids_.end()), document_ids_.end());
+}
+
+IndexSegment::IndexSegment(const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+                           const std::vector<std::vector<int>>& live_document_ids)
+    : first_generation_(segments.front()->first_generation_)
+    , last_generation_(segments.back()->last_generation_)
+{
+    for (const auto& segment : segments) {
+        words_.insert(words_.end(), segment->words_.begin(), segment->words_.end());
+    }
+    std::sort(words_.begin(), words_.end());
+    words_.erase(std::unique(words_.begin(), words_.end()), words_.end());
+
+    offsets_.push_back(0);
+    auto word_out = words_.begin();
+    for (const std::string_view word : words_) {
+        const size_t word_begin = postings_.size();
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const auto& live_ids = live_document_ids[i];
+            const auto postings = segments[i]->FindPostings(word);
+            std::copy_if(postings.begin(), postings.end(), std::back_inserter(postings_),
+                         [&live_ids](const Posting& posting) {
+                             return std::binary_search(live_ids.begin(), live_ids.end(), posting.document_id);
+                         });
+        }
+        if (postings_.size() == word_begin) {
+            continue;
+        }
+        std::sort(postings_.begin() + word_begin, postings_.end(), [](const Posting& lhs, const Posting& rhs) {
+            return lhs.document_id < rhs.document_id;
+        });
+        *word_out++ = word;
+        offsets_.push_back(postings_.size());
+    }
+    words_.erase(word_out, words_.end());
+
+    for (const auto& live_ids : live_document_ids) {
+        document_ids_.insert(document_ids_.end(), live_ids.begin(), live_ids.end());
+    }
+    std::sort(document_ids_.begin(), document_ids_.end());
+}
+
+IndexSegment::Postings IndexSegment::FindPostings(std::string_view word) const {
+    const auto it = std::lower_bound(words_.begin(), words_.end(), word);
+    if (it == words_.end() || *it != word) {
+        return {nullptr, nullptr, 0};
+    }
+    const size_t index = it - words_.begin();
+    const Posting* begin = postings_.data() + offsets_[index];
+    const Posting* end = postings_.data() + offsets_[index + 1];
+    return {begin, end, static_cast<size_t>(end - begin)};
+}
+
+const std::vector<int>& IndexSegment::GetDocumentIds() const {
+    return document_ids_;
+}
+
+bool IndexSegment::CoversGeneration(int generation) const {
+    return first_generation_ <= generation && generation <= last_generation_;
+}
+
+int IndexSegment::GetFirstGeneration() const {
+    return first_generation_;
+}
+
+int IndexSegment::GetLastGeneration() const {
+    return last_generation_;
+}
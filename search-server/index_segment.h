@@ -0,0 +1,49 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "paginator.h"
+
+// Immutable read-optimized part of the inverted index: sorted words with their
+// postings laid out in one array. Documents are sealed into segments in
+// batches, every batch gets the next generation number, and a segment made by
+// merging covers the contiguous range of generations of its sources.
+class IndexSegment {
+public:
+    struct Posting {
+        int document_id;
+        double term_freq;
+    };
+
+    using Postings = IteratorRange<const Posting*>;
+
+    IndexSegment(const std::map<std::string_view, std::map<int, double>>& word_to_document_freqs,
+                 int generation);
+
+    // Merges adjacent segments keeping only postings of live documents:
+    // live_document_ids[i] are the sorted ids to keep from segments[i]
+    IndexSegment(const std::vector<std::shared_ptr<const IndexSegment>>& segments,
+                 const std::vector<std::vector<int>>& live_document_ids);
+
+    Postings FindPostings(std::string_view word) const;
+
+    // Sorted ids of the documents the segment was built with
+    const std::vector<int>& GetDocumentIds() const;
+
+    bool CoversGeneration(int generation) const;
+
+    int GetFirstGeneration() const;
+
+    int GetLastGeneration() const;
+
+private:
+    std::vector<std::string_view> words_;
+    // Postings of words_[i] are postings_[offsets_[i]] .. postings_[offsets_[i + 1]]
+    std::vector<size_t> offsets_;
+    std::vector<Posting> postings_;
+    std::vector<int> document_ids_;
+    int first_generation_;
+    int last_generation_;
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <vector>
+
+// Vector keeping up to N elements inside the object itself and moving them to
+// the heap only when more are pushed. Meant for short-lived small lists of
+// trivially copyable values, such as words of a query.
+template <typename T, size_t N>
+class InlineVector {
+    static_assert(std::is_trivially_copyable_v<T>, "InlineVector supports only trivially copyable types");
+public:
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    void push_back(const T& value) {
+        if (!is_spilled_ && size_ == N) {
+            spilled_.assign(inline_.begin(), inline_.end());
+            is_spilled_ = true;
+        }
+        if (is_spilled_) {
+            spilled_.push_back(value);
+        } else {
+            inline_[size_] = value;
+        }
+        ++size_;
+    }
+
+    template <typename Iterator>
+    void insert(Iterator first, Iterator last) {
+        for (; first != last; ++first) {
+            push_back(*first);
+        }
+    }
+
+    void erase(const_iterator first, const_iterator last) {
+        const auto new_end = std::copy(last, cend(), begin() + (first - cbegin()));
+        resize(new_end - begin());
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    T& operator[](size_t index) {
+        return data()[index];
+    }
+
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+
+    T* data() {
+        return is_spilled_ ? spilled_.data() : inline_.data();
+    }
+
+    const T* data() const {
+        return is_spilled_ ? spilled_.data() : inline_.data();
+    }
+
+    iterator begin() {
+        return data();
+    }
+
+    iterator end() {
+        return data() + size_;
+    }
+
+    const_iterator begin() const {
+        return data();
+    }
+
+    const_iterator end() const {
+        return data() + size_;
+    }
+
+    const_iterator cbegin() const {
+        return begin();
+    }
+
+    const_iterator cend() const {
+        return end();
+    }
+
+private:
+    std::array<T, N> inline_;
+    std::vector<T> spilled_;
+    size_t size_ = 0;
+    bool is_spilled_ = false;
+
+    void resize(size_t size) {
+        if (is_spilled_) {
+            spilled_.resize(size);
+        }
+        size_ = size;
+    }
+};
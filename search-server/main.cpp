@@ -7,7 +7,17 @@
 #include "search_server.h"
 #include "request_queue.h"
 #include "remove_duplicates.h"
+#include "test_example_functions.h"
 
 int main() {
- 
+    TestPhrasesAndProximity();
+    TestStopWordsAndQueryParsing();
+    TestQueryExpansion();
+    TestThreadPool();
+    TestMatchDocuments();
+    TestSegmentsKeepLiveDocuments();
+    BenchmarkMatchDocuments(20000, std::thread::hardware_concurrency());
+    BenchmarkWordPositions(20000);
+    BenchmarkSegmentsIngest(50000);
+    BenchmarkQueryTailLatency(50000, std::thread::hardware_concurrency());
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "position_list.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+void EncodePositions(const std::vector<int>& positions, std::vector<uint8_t>& out) {
+    int previous = 0;
+    for (const int position : positions) {
+        uint32_t delta = static_cast<uint32_t>(position - previous);
+        while (delta >= 0x80) {
+            out.push_back(static_cast<uint8_t>(delta | 0x80));
+            delta >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(delta));
+        previous = position;
+    }
+}
+
+std::vector<int> DecodePositions(EncodedPositions encoded) {
+    std::vector<int> result;
+    result.reserve(encoded.size());
+    int previous = 0;
+    uint32_t delta = 0;
+    int shift = 0;
+    for (const uint8_t byte : encoded) {
+        delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (byte & 0x80) {
+            shift += 7;
+            continue;
+        }
+        previous += static_cast<int>(delta);
+        result.push_back(previous);
+        delta = 0;
+        shift = 0;
+    }
+    return result;
+}
+
+void PositionPostings::Add(int document_id, const std::vector<int>& positions) {
+    const uint32_t offset = static_cast<uint32_t>(bytes_.size());
+    EncodePositions(positions, bytes_);
+    const Entry entry{document_id, offset, static_cast<uint32_t>(bytes_.size() - offset)};
+    // Documents usually come in the order of their ids
+    if (entries_.empty() || entries_.back().document_id < document_id) {
+        entries_.push_back(entry);
+    } else {
+        entries_.insert(LowerBound(document_id), entry);
+    }
+}
+
+void PositionPostings::Remove(int document_id) {
+    const auto it = LowerBound(document_id);
+    if (it == entries_.end() || it->document_id != document_id) {
+        return;
+    }
+    removed_size_ += it->size;
+    entries_.erase(it);
+    if (removed_size_ * 2 > bytes_.size()) {
+        Compact();
+    }
+}
+
+EncodedPositions PositionPostings::Find(int document_id) const {
+    const auto it = LowerBound(document_id);
+    if (it == entries_.end() || it->document_id != document_id) {
+        return {nullptr, nullptr, 0};
+    }
+    const uint8_t* first = bytes_.data() + it->offset;
+    return {first, first + it->size, it->size};
+}
+
+bool PositionPostings::IsEmpty() const {
+    return entries_.empty();
+}
+
+std::vector<PositionPostings::Entry>::const_iterator PositionPostings::LowerBound(int document_id) const {
+    return std::lower_bound(entries_.begin(), entries_.end(), document_id,
+                            [](const Entry& lhs, int rhs) {
+                                return lhs.document_id < rhs;
+                            });
+}
+
+void PositionPostings::Compact() {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(bytes_.size() - removed_size_);
+    for (Entry& entry : entries_) {
+        const uint32_t offset = static_cast<uint32_t>(bytes.size());
+        bytes.insert(bytes.end(), bytes_.begin() + entry.offset, bytes_.begin() + entry.offset + entry.size);
+        entry.offset = offset;
+    }
+    bytes_ = std::move(bytes);
+    removed_size_ = 0;
+}
+
+void IntersectPositions(std::vector<int>& lhs, const std::vector<int>& rhs, int shift) {
+    auto out = lhs.begin();
+    auto rhs_it = rhs.begin();
+    for (auto it = lhs.begin(); it != lhs.end() && rhs_it != rhs.end(); ++it) {
+        const int wanted = *it + shift;
+        rhs_it = std::lower_bound(rhs_it, rhs.end(), wanted);
+        if (rhs_it != rhs.end() && *rhs_it == wanted) {
+            *out++ = *it;
+        }
+    }
+    lhs.erase(out, lhs.end());
+}
+
+int ComputeMinimalSpan(const std::vector<std::vector<int>>& position_lists) {
+    std::vector<std::pair<int, size_t>> merged;
+    for (size_t i = 0; i < position_lists.size(); ++i) {
+        for (const int position : position_lists[i]) {
+            merged.push_back({position, i});
+        }
+    }
+    std::sort(merged.begin(), merged.end());
+
+    std::vector<int> in_window(position_lists.size(), 0);
+    size_t covered = 0;
+    int result = std::numeric_limits<int>::max();
+    auto left = merged.begin();
+    for (auto right = merged.begin(); right != merged.end(); ++right) {
+        if (in_window[right->second]++ == 0) {
+            ++covered;
+        }
+        while (covered == position_lists.size()) {
+            result = std::min(result, right->first - left->first);
+            if (--in_window[left->second] == 0) {
+                --covered;
+            }
+            ++left;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "paginator.h"
+
+// Word positions are kept delta-encoded as varints: a typical position list of
+// a document takes one byte per occurrence instead of four.
+using EncodedPositions = IteratorRange<const uint8_t*>;
+
+// Appends the encoded positions to out
+void EncodePositions(const std::vector<int>& positions, std::vector<uint8_t>& out);
+
+std::vector<int> DecodePositions(EncodedPositions encoded);
+
+// Encoded position lists of one word in all documents containing it: the
+// lists lie back to back in one buffer, found by a sorted array of document ids.
+class PositionPostings {
+public:
+    // The document must not be in the postings yet
+    void Add(int document_id, const std::vector<int>& positions);
+
+    void Remove(int document_id);
+
+    // Empty if the document doesn't contain the word
+    EncodedPositions Find(int document_id) const;
+
+    bool IsEmpty() const;
+
+private:
+    struct Entry {
+        int document_id;
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::vector<Entry> entries_;
+    std::vector<uint8_t> bytes_;
+    // Bytes of the removed documents, dropped once they are the majority
+    size_t removed_size_ = 0;
+
+    std::vector<Entry>::const_iterator LowerBound(int document_id) const;
+
+    void Compact();
+};
+
+// Leaves in lhs only those positions p for which p + shift is present in rhs.
+// Both lists must be sorted.
+void IntersectPositions(std::vector<int>& lhs, const std::vector<int>& rhs, int shift);
+
+// Length of the shortest window of positions containing at least one position
+// from every list. Lists must be sorted and non-empty.
+int ComputeMinimalSpan(const std::vector<std::vector<int>>& position_lists);
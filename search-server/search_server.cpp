@@ -1,26 +1,29 @@
 #include "search_server.h"
 
 #include <functional>
+#include <limits>
 #include <numeric>
 #include <cmath>
 #include <string_view>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 
-SearchServer::SearchServer(const std::string& stop_words_text)
+SearchServer::SearchServer(const std::string& stop_words_text, WordPositions word_positions)
     : SearchServer(
-        SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
+        SplitIntoWords(stop_words_text), word_positions)  // Invoke delegating constructor from string container
 {
 }
 
-SearchServer::SearchServer(const std::string_view& stop_words_text)
+SearchServer::SearchServer(const std::string_view& stop_words_text, WordPositions word_positions)
     : SearchServer(
-        SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
+        SplitIntoWords(stop_words_text), word_positions)  // Invoke delegating constructor from string container
 {
 }
 
-SearchServer::SearchServer(const char* stop_words_text)
+SearchServer::SearchServer(const char* stop_words_text, WordPositions word_positions)
     : SearchServer(
-        SplitIntoWords(std::string_view(stop_words_text)))  // Invoke delegating constructor from string container
+        SplitIntoWords(std::string_view(stop_words_text)), word_positions)  // Invoke delegating constructor from string container
 {
 }
 
@@ -30,17 +33,38 @@ void SearchServer::AddDocument(int document_id, const std::string_view document,
     if ((document_id < 0) || (documents_.count(document_id) > 0)) {
         throw invalid_argument("Invalid document_id"s);
     }
+    CollectMergedSegment();
     const auto words = SplitIntoWordsNoStop(document);
 
     const double inv_word_count = 1.0 / words.size();
     for (const std::string_view word : words) {
-        auto it = documents_words_.insert(std::string(word));
-        std::string_view word_view = *(it.first);
-        word_to_document_freqs_[word_view][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word_view] += inv_word_count;
+        auto it = word_to_document_count_.find(word);
+        if (it == word_to_document_count_.end()) {
+            // Words of removed documents are kept in the dictionary
+            std::string_view stored_word = documents_words_.Find(word);
+            if (stored_word.data() == nullptr) {
+                stored_word = documents_words_.Add(word);
+            }
+            it = word_to_document_count_.emplace(stored_word, 0).first;
+        }
+        word_to_document_freqs_[it->first][document_id] += inv_word_count;
+        document_to_word_freqs_[document_id][it->first] += inv_word_count;
+    }
+    if (const auto document_it = document_to_word_freqs_.find(document_id);
+        document_it != document_to_word_freqs_.end()) {
+        for (const auto& [word, _] : document_it->second) {
+            ++word_to_document_count_.at(word);
+        }
+    }
+    if (word_positions_ == WordPositions::STORE) {
+        IndexWordPositions(document_id, document);
     }
     documents_.emplace(document_id, DocumentData{ComputeAverageRating(ratings), status});
     document_ids_.insert(document_id);
+
+    if (++mutable_document_count_ >= SEGMENT_DOCUMENT_COUNT) {
+        SealMutableSegment();
+    }
 }
 
 std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const {
@@ -86,6 +110,36 @@ std::vector<Document> SearchServer::FindTopDocuments(const std::execution::seque
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
+std::vector<Document> SearchServer::FindTopDocuments(ThreadPool& pool,
+                                                     const std::string_view raw_query,
+                                                     DocumentStatus status) const
+{
+    return FindTopDocuments(
+        pool, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
+            return document_status == status;
+        });
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(ThreadPool& pool,
+                                                     const std::string_view raw_query) const
+{
+    return FindTopDocuments(pool, raw_query, DocumentStatus::ACTUAL);
+}
+
+void SearchServer::SortAndCutTopDocuments(std::vector<Document>& matched_documents) {
+    std::sort(matched_documents.begin(), matched_documents.end(),
+         [](const Document& lhs, const Document& rhs) {
+             if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
+                 return lhs.rating > rhs.rating;
+             } else {
+                 return lhs.relevance > rhs.relevance;
+             }
+         });
+    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
+        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+    }
+}
+
 int SearchServer::GetDocumentCount() const {
     return documents_.size();
 }
@@ -106,14 +160,33 @@ void SearchServer::RemoveDocument(int document_id){
     if (document_it == document_to_word_freqs_.end()) {
         return;
     }
+    CollectMergedSegment();
 
+    // Sealed segments keep the postings, they are skipped once the document is gone
+    const int generation = documents_.at(document_id).generation;
+    const bool is_mutable = generation == MUTABLE_GENERATION;
+    std::vector<std::string_view> unused_words;
     for(auto& [word, freq] : (*document_it).second){
-        word_to_document_freqs_[word].erase(document_id);
+        if (--word_to_document_count_.at(word) == 0) {
+            unused_words.push_back(word);
+        }
+        if (is_mutable) {
+            word_to_document_freqs_.at(word).erase(document_id);
+        }
+        if (word_positions_ == WordPositions::STORE) {
+            word_to_document_positions_.at(word).Remove(document_id);
+        }
     }
+    EraseUnusedWords(unused_words);
 
     document_to_word_freqs_.erase(document_it);
     document_ids_.erase(std::find(document_ids_.begin(), document_ids_.end(), document_id));
     documents_.erase(document_id);
+    if (is_mutable) {
+        --mutable_document_count_;
+    } else {
+        CountRemovedDocument(generation);
+    }
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy, int document_id) {
@@ -121,6 +194,7 @@ void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy,
     if (document_it == document_to_word_freqs_.end()) {
         return;
     }
+    CollectMergedSegment();
 
     std::map<std::string_view, double>& doc = (*document_it).second;
     std::vector<std::string_view> words_list(doc.size());
@@ -130,23 +204,88 @@ void SearchServer::RemoveDocument(const std::execution::parallel_policy& policy,
                     return word_freq.first;
                });
 
-    auto& word_to_doc = word_to_document_freqs_;
+    std::vector<std::string_view> unused_words;
+    for (const std::string_view word : words_list) {
+        if (--word_to_document_count_.at(word) == 0) {
+            unused_words.push_back(word);
+        }
+    }
 
-    std::for_each(policy, words_list.begin(), words_list.end(),
-               [&word_to_doc, document_id](const std::string_view current_word){
-                    (word_to_doc)[current_word].erase(document_id);
-                    return true;
-               });
+    const int generation = documents_.at(document_id).generation;
+    if (generation == MUTABLE_GENERATION) {
+        auto& word_to_doc = word_to_document_freqs_;
+
+        std::for_each(policy, words_list.begin(), words_list.end(),
+                   [&word_to_doc, document_id](const std::string_view current_word){
+                        word_to_doc.at(current_word).erase(document_id);
+                        return true;
+                   });
+    }
+
+    if (word_positions_ == WordPositions::STORE) {
+        auto& word_to_positions = word_to_document_positions_;
+
+        std::for_each(policy, words_list.begin(), words_list.end(),
+                   [&word_to_positions, document_id](const std::string_view current_word){
+                        word_to_positions.at(current_word).Remove(document_id);
+                   });
+    }
+    EraseUnusedWords(unused_words);
 
     document_to_word_freqs_.erase(document_it);
     document_ids_.erase(std::find(policy, document_ids_.begin(), document_ids_.end(), document_id));
     documents_.erase(document_id);
+    if (generation == MUTABLE_GENERATION) {
+        --mutable_document_count_;
+    } else {
+        CountRemovedDocument(generation);
+    }
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy& policy, int document_id) {
     RemoveDocument(document_id);
 }
 
+void SearchServer::RemoveDocument(ThreadPool& pool, int document_id) {
+    auto document_it = document_to_word_freqs_.find(document_id);
+    if (document_it == document_to_word_freqs_.end()) {
+        return;
+    }
+    CollectMergedSegment();
+
+    std::vector<std::string_view> words_list;
+    std::vector<std::string_view> unused_words;
+    words_list.reserve(document_it->second.size());
+    for (const auto& [word, _] : document_it->second) {
+        if (--word_to_document_count_.at(word) == 0) {
+            unused_words.push_back(word);
+        }
+        words_list.push_back(word);
+    }
+
+    const int generation = documents_.at(document_id).generation;
+    const bool is_mutable = generation == MUTABLE_GENERATION;
+    pool.ParallelFor(words_list.size(), WORDS_GRAIN_SIZE, [&](size_t index, size_t) {
+        const std::string_view word = words_list[index];
+        if (is_mutable) {
+            word_to_document_freqs_.at(word).erase(document_id);
+        }
+        if (word_positions_ == WordPositions::STORE) {
+            word_to_document_positions_.at(word).Remove(document_id);
+        }
+    });
+    EraseUnusedWords(unused_words);
+
+    document_to_word_freqs_.erase(document_it);
+    document_ids_.erase(document_id);
+    documents_.erase(document_id);
+    if (is_mutable) {
+        --mutable_document_count_;
+    } else {
+        CountRemovedDocument(generation);
+    }
+}
+
 std::set<int>::const_iterator SearchServer::begin() {
     return document_ids_.cbegin();
 }
@@ -171,13 +310,14 @@ SearchServer::MathedDocuments SearchServer::MatchDocument(const std::string_view
                         return words_map.count(word) == 0;
                     });
 
-    if (!no_minus_words) {
+    if (!no_minus_words || !MatchesPhrases(query.phrases, document_id)) {
         return {std::vector<std::string_view>(), documents_.at(document_id).status};
     }
 
-    std::vector<std::string_view> matched_words(query.plus_words.size());
+    const QueryWords plus_words = CollectPlusWords(query);
+    std::vector<std::string_view> matched_words(plus_words.size());
 
-    auto end_it = std::copy_if(query.plus_words.begin(), query.plus_words.end(), matched_words.begin(),
+    auto end_it = std::copy_if(plus_words.begin(), plus_words.end(), matched_words.begin(),
                                 [&words_map](const std::string_view& word){
                                     return words_map.count(word) != 0;
                                 });
@@ -203,7 +343,7 @@ SearchServer::MathedDocuments SearchServer::MatchDocument(const std::execution::
         throw std::out_of_range("No document with id = " + std::to_string(document_id));
     }
 
-    QueryVec query = ParseQueryVec(raw_query);
+    const Query query = ParseQuery(raw_query);
 
     const std::map<std::string_view, double>& words_map = (*it).second;
 
@@ -212,28 +352,90 @@ SearchServer::MathedDocuments SearchServer::MatchDocument(const std::execution::
                         return words_map.count(word) == 0;
                     });
 
-    if (!no_minus_words) {
+    if (!no_minus_words || !MatchesPhrases(query.phrases, document_id)) {
         return {std::vector<std::string_view>(), documents_.at(document_id).status};
     }
 
-    std::vector<std::string_view> matched_words(query.plus_words.size());
+    const QueryWords plus_words = CollectPlusWords(query);
+    std::vector<std::string_view> matched_words(plus_words.size());
 
-    auto end_it = std::copy_if(policy, query.plus_words.begin(), query.plus_words.end(), matched_words.begin(),
+    auto end_it = std::copy_if(policy, plus_words.begin(), plus_words.end(), matched_words.begin(),
                                 [&words_map](const std::string_view& word){
                                     return words_map.count(word) != 0;
                                 });
 
     matched_words.erase(end_it, matched_words.end());
-    std::sort(matched_words.begin(), matched_words.end());
 
-    end_it = std::unique(matched_words.begin(), matched_words.end());
-    matched_words.erase(end_it, matched_words.end());
+    return {matched_words, documents_.at(document_id).status};
+}
+
+SearchServer::MathedDocuments SearchServer::MatchDocument(ThreadPool& pool,
+                                                          const std::string_view& raw_query,
+                                                          int document_id) const
+{
+    auto it = document_to_word_freqs_.find(document_id);
+    if (it == document_to_word_freqs_.end()) {
+        throw std::out_of_range("No document with id = " + std::to_string(document_id));
+    }
+
+    const Query query = ParseQuery(raw_query);
+
+    const std::map<std::string_view, double>& words_map = (*it).second;
+
+    bool no_minus_words = std::all_of(query.minus_words.begin(), query.minus_words.end(),
+                    [&words_map](const std::string_view& word){
+                        return words_map.count(word) == 0;
+                    });
+
+    if (!no_minus_words || !MatchesPhrases(query.phrases, document_id)) {
+        return {std::vector<std::string_view>(), documents_.at(document_id).status};
+    }
+
+    const QueryWords plus_words = CollectPlusWords(query);
+    std::vector<char> is_matched(plus_words.size());
+    pool.ParallelFor(plus_words.size(), WORDS_GRAIN_SIZE, [&](size_t index, size_t) {
+        is_matched[index] = words_map.count(plus_words[index]) != 0;
+    });
+
+    std::vector<std::string_view> matched_words;
+    for (size_t i = 0; i < is_matched.size(); ++i) {
+        if (is_matched[i]) {
+            matched_words.push_back(plus_words[i]);
+        }
+    }
 
     return {matched_words, documents_.at(document_id).status};
 }
 
+SearchServer::BatchMatch SearchServer::MatchDocuments(const std::string_view raw_query,
+                                                      const std::vector<int>& document_ids) const
+{
+    return MatchDocumentsBatch(std::execution::seq, raw_query, document_ids);
+}
+
+SearchServer::BatchMatch SearchServer::MatchDocuments(const std::execution::sequenced_policy& policy,
+                                                      const std::string_view raw_query,
+                                                      const std::vector<int>& document_ids) const
+{
+    return MatchDocumentsBatch(policy, raw_query, document_ids);
+}
+
+SearchServer::BatchMatch SearchServer::MatchDocuments(const std::execution::parallel_policy& policy,
+                                                      const std::string_view raw_query,
+                                                      const std::vector<int>& document_ids) const
+{
+    return MatchDocumentsBatch(policy, raw_query, document_ids);
+}
+
+SearchServer::BatchMatch SearchServer::MatchDocuments(ThreadPool& pool,
+                                                      const std::string_view raw_query,
+                                                      const std::vector<int>& document_ids) const
+{
+    return MatchDocumentsBatch(pool, raw_query, document_ids);
+}
+
 bool SearchServer::IsStopWord(const std::string_view word) const {
-    return stop_words_view_.count(word) > 0;
+    return stop_words_.Contains(word);
 }
 
 
@@ -266,7 +468,8 @@ int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
     return result;
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view word) const {
+SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view word,
+                                                     bool has_control_chars) const {
     using namespace std;
     if (word.empty()) {
         throw invalid_argument("Query word is empty"s);
@@ -276,59 +479,480 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view word) cons
         is_minus = true;
         word = word.substr(1);
     }
-    if (word.empty() || word[0] == '-' || !IsValidWord(word)) {
-        throw invalid_argument("Query word "s + word.data() + " is invalid");
+    if (word.empty() || word[0] == '-' || has_control_chars) {
+        throw invalid_argument("Query word "s + std::string(word) + " is invalid"s);
     }
 
     return {word, is_minus, IsStopWord(word)};
 }
 
+size_t SearchServer::ScanQueryWord(const std::string_view text, size_t pos, bool& has_control_chars) {
+    has_control_chars = false;
+    for (; pos < text.size() && text[pos] != ' ' && text[pos] != '"'; ++pos) {
+        has_control_chars |= text[pos] >= '\0' && text[pos] < ' ';
+    }
+    return pos;
+}
+
+bool SearchServer::IsExpandableWord(const std::string_view word) {
+    if (word.size() < 2) {
+        return false;
+    }
+    if (word.back() == '*' || word.back() == '~') {
+        return true;
+    }
+    return word[word.size() - 2] == '~' && std::isdigit(static_cast<unsigned char>(word.back()));
+}
+
+std::vector<SearchServer::WordExpansion> SearchServer::ExpandQueryWord(const std::string_view word, size_t max_count) const {
+    using namespace std;
+    // Words stay in the dictionary after their last document is removed
+    const auto is_indexed = [this](const std::string_view dictionary_word) {
+        const auto it = word_to_document_count_.find(dictionary_word);
+        return it != word_to_document_count_.end() && it->second > 0;
+    };
+
+    // Index keys are the views returned by the dictionary, so expansions are valid as long as the index
+    std::vector<WordExpansion> result;
+    if (word.back() == '*') {
+        for (const std::string_view dictionary_word : documents_words_.FindByPrefix(
+                 word.substr(0, word.size() - 1), max_count, is_indexed)) {
+            result.push_back({dictionary_word, 1.0});
+        }
+    } else {
+        const auto tilde = word.rfind('~');
+        const int max_distance = tilde + 1 == word.size() ? 1 : word.back() - '0';
+        if (max_distance > MAX_EDIT_DISTANCE) {
+            throw invalid_argument("Edit distance in query word "s + std::string(word) + " is too large"s);
+        }
+        for (const auto [dictionary_word, distance] : documents_words_.FindSimilar(
+                 word.substr(0, tilde), max_distance, max_count, is_indexed)) {
+            result.push_back({dictionary_word, std::pow(FUZZY_EDIT_WEIGHT, distance)});
+        }
+    }
+    return result;
+}
+
 SearchServer::Query SearchServer::ParseQuery(const std::string_view text) const {
     Query result;
 
-    for (const std::string_view& word : SplitIntoWords(text)) {
-        const QueryWord query_word = ParseQueryWord(word);
-        if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                result.minus_words.insert(query_word.data);
-            } else {
-                result.plus_words.insert(query_word.data);
-            }
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (text[pos] == ' ') {
+            ++pos;
+        } else if (text[pos] == '"') {
+            pos = ParsePhrase(text, pos + 1, result);
+        } else {
+            bool has_control_chars;
+            const size_t word_end = ScanQueryWord(text, pos, has_control_chars);
+            AddQueryWord(ParseQueryWord(text.substr(pos, word_end - pos), has_control_chars), result);
+            pos = word_end;
         }
     }
+
+    for (QueryWords* words : {&result.plus_words, &result.minus_words}) {
+        std::sort(words->begin(), words->end());
+        words->erase(std::unique(words->begin(), words->end()), words->end());
+    }
+    auto& expanded_words = result.expanded_words;
+    std::sort(expanded_words.begin(), expanded_words.end(),
+              [](const ExpandedWord& lhs, const ExpandedWord& rhs) {
+                  return lhs.data < rhs.data;
+              });
+    expanded_words.erase(std::unique(expanded_words.begin(), expanded_words.end(),
+                                     [](const ExpandedWord& lhs, const ExpandedWord& rhs) {
+                                         return lhs.data == rhs.data;
+                                     }),
+                         expanded_words.end());
     return result;
 }
 
-SearchServer::QueryVec SearchServer::ParseQueryVec(const std::string_view text) const {
-    QueryVec result;
+SearchServer::QueryWords SearchServer::CollectPlusWords(const Query& query) {
+    if (query.expanded_words.empty()) {
+        return query.plus_words;
+    }
+    QueryWords words = query.plus_words;
+    for (const ExpandedWord& expanded_word : query.expanded_words) {
+        for (const WordExpansion& expansion : expanded_word.expansions) {
+            words.push_back(expansion.data);
+        }
+    }
+    std::sort(words.begin(), words.end());
+    words.erase(std::unique(words.begin(), words.end()), words.end());
+    return words;
+}
+
+void SearchServer::AddQueryWord(const QueryWord& query_word, Query& query) const {
+    if (query_word.is_stop) {
+        return;
+    }
+    if (!IsExpandableWord(query_word.data)) {
+        (query_word.is_minus ? query.minus_words : query.plus_words).push_back(query_word.data);
+        return;
+    }
+    // A document with any of the words is excluded, so minus words aren't capped
+    auto expansions = ExpandQueryWord(query_word.data, query_word.is_minus
+                                                           ? std::numeric_limits<size_t>::max()
+                                                           : static_cast<size_t>(MAX_EXPANDED_WORDS));
+    if (query_word.is_minus) {
+        for (const WordExpansion& expansion : expansions) {
+            query.minus_words.push_back(expansion.data);
+        }
+    } else if (!expansions.empty()) {
+        query.expanded_words.push_back({query_word.data, std::move(expansions)});
+    }
+}
 
-    auto words = SplitIntoWords(text);
-    result.minus_words.reserve(words.size());
-    result.plus_words.reserve(words.size());
+size_t SearchServer::ParsePhrase(const std::string_view text, size_t pos, Query& query) const {
+    using namespace std;
+    if (word_positions_ != WordPositions::STORE) {
+        throw invalid_argument("Phrase queries require stored word positions"s);
+    }
 
-    for (const std::string_view& word : words) {
-        const QueryWord query_word = ParseQueryWord(word);
+    Phrase phrase;
+    int offset = 0;
+    while (true) {
+        if (pos == text.size()) {
+            throw invalid_argument("Phrase is not closed by a quote"s);
+        }
+        if (text[pos] == ' ') {
+            ++pos;
+            continue;
+        }
+        if (text[pos] == '"') {
+            ++pos;
+            break;
+        }
+        bool has_control_chars;
+        const size_t word_end = ScanQueryWord(text, pos, has_control_chars);
+        const QueryWord query_word = ParseQueryWord(text.substr(pos, word_end - pos), has_control_chars);
+        if (query_word.is_minus) {
+            throw invalid_argument("Minus word -"s + std::string(query_word.data) + " inside a phrase"s);
+        }
+        if (IsExpandableWord(query_word.data)) {
+            throw invalid_argument("Expandable word "s + std::string(query_word.data) + " inside a phrase"s);
+        }
         if (!query_word.is_stop) {
-            if (query_word.is_minus) {
-                result.minus_words.push_back(query_word.data);
-            } else {
-                result.plus_words.push_back(query_word.data);
+            phrase.push_back({query_word.data, offset});
+            query.plus_words.push_back(query_word.data);
+        }
+        ++offset;
+        pos = word_end;
+    }
+
+    if (phrase.size() > 1) {
+        query.phrases.push_back(std::move(phrase));
+    }
+    return pos;
+}
+
+void SearchServer::IndexWordPositions(int document_id, const std::string_view document) {
+    std::map<std::string_view, std::vector<int>> word_positions;
+    int position = 0;
+    for (const std::string_view word : SplitIntoWords(document)) {
+        if (!IsStopWord(word)) {
+            word_positions[word_to_document_count_.find(word)->first].push_back(position);
+        }
+        ++position;
+    }
+    for (const auto& [word, positions] : word_positions) {
+        word_to_document_positions_[word].Add(document_id, positions);
+    }
+}
+
+EncodedPositions SearchServer::FindWordPositions(const std::string_view word, int document_id) const {
+    const auto word_it = word_to_document_positions_.find(word);
+    if (word_it == word_to_document_positions_.end()) {
+        return {nullptr, nullptr, 0};
+    }
+    return word_it->second.Find(document_id);
+}
+
+bool SearchServer::MatchesPhrases(const std::vector<Phrase>& phrases, int document_id) const {
+    for (const Phrase& phrase : phrases) {
+        std::vector<std::pair<std::vector<int>, int>> word_positions;
+        for (const auto& [word, offset] : phrase) {
+            const EncodedPositions encoded = FindWordPositions(word, document_id);
+            if (encoded.begin() == encoded.end()) {
+                return false;
             }
+            word_positions.push_back({DecodePositions(encoded), offset});
+        }
+
+        // Start from the rarest word so that the candidate list is as short as possible
+        std::sort(word_positions.begin(), word_positions.end(),
+                  [](const auto& lhs, const auto& rhs) {
+                      return lhs.first.size() < rhs.first.size();
+                  });
+
+        auto& [phrase_starts, first_offset] = word_positions.front();
+        for (int& position : phrase_starts) {
+            position -= first_offset;
+        }
+        for (size_t i = 1; i < word_positions.size() && !phrase_starts.empty(); ++i) {
+            IntersectPositions(phrase_starts, word_positions[i].first, word_positions[i].second);
+        }
+        if (phrase_starts.empty()) {
+            return false;
         }
     }
+    return true;
+}
 
-    return result;
+double SearchServer::ComputeProximityBonus(const Query& query, int document_id) const {
+    std::vector<std::vector<int>> position_lists;
+    for (const std::string_view word : query.plus_words) {
+        const EncodedPositions encoded = FindWordPositions(word, document_id);
+        if (encoded.begin() != encoded.end()) {
+            position_lists.push_back(DecodePositions(encoded));
+        }
+    }
+    // An expansion may repeat a plain word or an expansion of another word,
+    // its positions are counted once, with the first of them
+    std::vector<std::string_view> counted_words(query.plus_words.begin(), query.plus_words.end());
+    for (const ExpandedWord& expanded_word : query.expanded_words) {
+        std::vector<int> positions;
+        for (const WordExpansion& expansion : expanded_word.expansions) {
+            if (std::find(counted_words.begin(), counted_words.end(), expansion.data) != counted_words.end()) {
+                continue;
+            }
+            counted_words.push_back(expansion.data);
+            const EncodedPositions encoded = FindWordPositions(expansion.data, document_id);
+            if (encoded.begin() != encoded.end()) {
+                const std::vector<int> expansion_positions = DecodePositions(encoded);
+                const size_t middle = positions.size();
+                positions.insert(positions.end(), expansion_positions.begin(), expansion_positions.end());
+                std::inplace_merge(positions.begin(), positions.begin() + middle, positions.end());
+            }
+        }
+        if (!positions.empty()) {
+            position_lists.push_back(std::move(positions));
+        }
+    }
+    if (position_lists.size() < 2) {
+        return 0.0;
+    }
+    // The span is never shorter than the number of gaps between the words,
+    // so closely placed words get the whole weight.
+    // Lists of distinct words never share a position, so the span is positive
+    const int span = ComputeMinimalSpan(position_lists);
+    return span > 0 ? PROXIMITY_WEIGHT * (position_lists.size() - 1) / span : 0.0;
 }
 
-std::set<std::string_view> SearchServer::MakeStopWordsSet(const std::vector<std::string>& words) {
-    std::set<std::string_view> result;
-    for (const std::string& word : words) {
-        result.emplace(word);
+void SearchServer::ApplyWordPositions(const Query& query,
+                                      std::map<int, double>& document_to_relevance) const {
+    if (word_positions_ != WordPositions::STORE) {
+        return;
+    }
+    if (!query.phrases.empty()) {
+        for (auto it = document_to_relevance.begin(); it != document_to_relevance.end();) {
+            if (MatchesPhrases(query.phrases, it->first)) {
+                ++it;
+            } else {
+                it = document_to_relevance.erase(it);
+            }
+        }
+    }
+    if (query.plus_words.size() + query.expanded_words.size() < 2) {
+        return;
+    }
+
+    // Decoding positions of every matched document would make plain queries
+    // much slower, and proximity only matters for the top of the results
+    std::vector<std::pair<double, int>> candidates;
+    candidates.reserve(document_to_relevance.size());
+    for (const auto [document_id, relevance] : document_to_relevance) {
+        candidates.push_back({relevance, document_id});
+    }
+    if (candidates.size() > static_cast<size_t>(PROXIMITY_CANDIDATE_COUNT)) {
+        std::nth_element(candidates.begin(), candidates.begin() + PROXIMITY_CANDIDATE_COUNT, candidates.end(),
+                         std::greater<>());
+        candidates.resize(PROXIMITY_CANDIDATE_COUNT);
+    }
+    for (const auto& [relevance, document_id] : candidates) {
+        const double bonus = ComputeProximityBonus(query, document_id);
+        document_to_relevance.at(document_id) = relevance * (1.0 + bonus);
     }
-    return result;
 }
 
 // Existence required
 double SearchServer::ComputeWordInverseDocumentFreq(const std::string_view word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+    return log(GetDocumentCount() * 1.0 / word_to_document_count_.at(word));
+}
+
+std::vector<SearchServer::PostingsSlice> SearchServer::SlicePostings(const Query& query) const {
+    std::vector<PostingsSlice> slices;
+    const auto slice_word = [&](size_t query_word_index, const std::string_view word, double weight) {
+        const auto count_it = word_to_document_count_.find(word);
+        if (count_it == word_to_document_count_.end() || count_it->second == 0) {
+            return;
+        }
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
+
+        // The mutable segment holds at most SEGMENT_DOCUMENT_COUNT documents
+        const auto it = word_to_document_freqs_.find(word);
+        if (it != word_to_document_freqs_.end() && !it->second.empty()) {
+            slices.push_back({query_word_index, weight, inverse_document_freq, &it->second,
+                              nullptr, nullptr, nullptr});
+        }
+        for (const SealedSegment& segment : segments_) {
+            const auto postings = segment.index->FindPostings(word);
+            for (const IndexSegment::Posting* first = postings.begin(); first != postings.end();) {
+                const size_t slice_size = std::min<size_t>(POSTINGS_GRAIN_SIZE, postings.end() - first);
+                slices.push_back({query_word_index, weight, inverse_document_freq, nullptr,
+                                  segment.index.get(), first, first + slice_size});
+                first += slice_size;
+            }
+        }
+    };
+
+    for (size_t i = 0; i < query.plus_words.size(); ++i) {
+        slice_word(i, query.plus_words[i], 1.0);
+    }
+    for (size_t i = 0; i < query.expanded_words.size(); ++i) {
+        for (const auto& [word, weight] : query.expanded_words[i].expansions) {
+            slice_word(query.plus_words.size() + i, word, weight);
+        }
+    }
+    return slices;
+}
+
+void SearchServer::EraseUnusedWords(const std::vector<std::string_view>& words) {
+    for (const std::string_view word : words) {
+        word_to_document_count_.erase(word);
+        word_to_document_freqs_.erase(word);
+        word_to_document_positions_.erase(word);
+    }
+}
+
+SearchServer::RelevanceScratchPtr SearchServer::TakeRelevanceScratch(size_t worker_count) const {
+    std::unique_ptr<RelevanceScratch> scratch;
+    {
+        std::lock_guard lock(relevance_scratch_mutex_);
+        if (!free_relevance_scratches_.empty()) {
+            scratch = std::move(free_relevance_scratches_.back());
+            free_relevance_scratches_.pop_back();
+        }
+    }
+    if (!scratch) {
+        scratch = std::make_unique<RelevanceScratch>();
+    }
+    // Pools of different sizes may share the scratch, so it only grows
+    if (scratch->worker_relevance.size() < worker_count) {
+        scratch->worker_relevance.resize(worker_count);
+    }
+    return RelevanceScratchPtr(scratch.release(), RelevanceScratchReturn{this});
+}
+
+void SearchServer::RelevanceScratchReturn::operator()(RelevanceScratch* scratch) const {
+    std::unique_ptr<RelevanceScratch> owned_scratch(scratch);
+    for (RelevanceEntries& worker_part : owned_scratch->worker_relevance) {
+        worker_part.clear();
+    }
+    owned_scratch->relevance.clear();
+    std::lock_guard lock(server->relevance_scratch_mutex_);
+    server->free_relevance_scratches_.push_back(std::move(owned_scratch));
+}
+
+void SearchServer::CountRemovedDocument(int generation) {
+    const auto segment_it = std::partition_point(segments_.begin(), segments_.end(),
+                                                 [generation](const SealedSegment& segment) {
+                                                     return segment.index->GetLastGeneration() < generation;
+                                                 });
+    ++segment_it->removed_document_count;
+    StartSegmentsMerge();
+}
+
+void SearchServer::SealMutableSegment() {
+    auto segment = std::make_shared<const IndexSegment>(word_to_document_freqs_, next_generation_++);
+    for (const int document_id : segment->GetDocumentIds()) {
+        documents_.at(document_id).generation = segment->GetLastGeneration();
+    }
+    segments_.push_back({std::move(segment)});
+    word_to_document_freqs_.clear();
+    mutable_document_count_ = 0;
+    StartSegmentsMerge();
+}
+
+void SearchServer::StartSegmentsMerge() {
+    if (merged_segment_.valid()) {
+        return;
+    }
+
+    // Segments of the same generation span have been merged the same number of times,
+    // so merging them SEGMENT_MERGE_FACTOR at a time keeps O(log n) segments
+    const auto span = [](const SealedSegment& segment) {
+        return segment.index->GetLastGeneration() - segment.index->GetFirstGeneration();
+    };
+    for (size_t first = 0; first + SEGMENT_MERGE_FACTOR <= segments_.size(); ++first) {
+        const auto sources_begin = segments_.begin() + first;
+        const auto sources_end = sources_begin + SEGMENT_MERGE_FACTOR;
+        if (std::all_of(sources_begin, sources_end, [&](const SealedSegment& segment) {
+                return span(segment) == span(*sources_begin);
+            })) {
+            StartSegmentsMerge(first, first + SEGMENT_MERGE_FACTOR);
+            return;
+        }
+    }
+
+    // Merges drop the postings of removed documents, but the largest segments
+    // wait for their merge for long, so they are rewritten alone
+    for (size_t i = 0; i < segments_.size();) {
+        const SealedSegment& segment = segments_[i];
+        const size_t document_count = segment.index->GetDocumentIds().size();
+        if (segment.removed_document_count == 0
+            || segment.removed_document_count < SEGMENT_REMOVED_SHARE * document_count) {
+            ++i;
+        } else if (static_cast<size_t>(segment.removed_document_count) == document_count) {
+            // No generation of the segment is used by a document anymore
+            segments_.erase(segments_.begin() + i);
+        } else {
+            StartSegmentsMerge(i, i + 1);
+            return;
+        }
+    }
+}
+
+void SearchServer::StartSegmentsMerge(size_t first, size_t last) {
+    std::vector<std::shared_ptr<const IndexSegment>> sources;
+    std::vector<std::vector<int>> live_document_ids;
+    merge_removed_document_count_ = 0;
+    for (size_t i = first; i < last; ++i) {
+        const IndexSegment& source = *sources.emplace_back(segments_[i].index);
+        merge_removed_document_count_ += segments_[i].removed_document_count;
+        std::vector<int>& live_ids = live_document_ids.emplace_back();
+        for (const int document_id : source.GetDocumentIds()) {
+            const auto document_it = documents_.find(document_id);
+            if (document_it != documents_.end() && source.CoversGeneration(document_it->second.generation)) {
+                live_ids.push_back(document_id);
+            }
+        }
+    }
+    merged_segment_ = std::async(std::launch::async,
+        [sources = std::move(sources), live_document_ids = std::move(live_document_ids)] {
+            return std::make_shared<const IndexSegment>(sources, live_document_ids);
+        });
+}
+
+void SearchServer::CollectMergedSegment() {
+    using namespace std::chrono_literals;
+    if (!merged_segment_.valid() || merged_segment_.wait_for(0s) != std::future_status::ready) {
+        return;
+    }
+
+    std::shared_ptr<const IndexSegment> merged = merged_segment_.get();
+    const auto sources_begin = std::find_if(segments_.begin(), segments_.end(), [&merged](const auto& segment) {
+        return segment.index->GetFirstGeneration() == merged->GetFirstGeneration();
+    });
+    const auto sources_end = std::find_if(sources_begin, segments_.end(), [&merged](const auto& segment) {
+        return segment.index->GetFirstGeneration() > merged->GetLastGeneration();
+    });
+    // Documents removed while the merge was running still have postings in the merged segment
+    int removed_document_count = -merge_removed_document_count_;
+    for (auto it = sources_begin; it != sources_end; ++it) {
+        removed_document_count += it->removed_document_count;
+    }
+    *sources_begin = {std::move(merged), removed_document_count};
+    segments_.erase(sources_begin + 1, sources_end);
+    StartSegmentsMerge();
 }
@@ -1,100 +1,410 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <execution>
+#include <future>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <stdexcept>
 #include <tuple>
 
 #include "string_processing.h"
 #include "document.h"
+#include "concurrent_map.h"
+#include "index_segment.h"
+#include "inline_vector.h"
+#include "position_list.h"
+#include "stop_word_set.h"
+#include "term_dictionary.h"
+#include "thread_pool.h"
 #include "log_duration.h"
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double EPSILON = 1e-6;
+// Relevance of a document with the query words next to each other grows by this share
+const double PROXIMITY_WEIGHT = 0.5;
+// Proximity reorders only this many of the most relevant documents
+const int PROXIMITY_CANDIDATE_COUNT = 4 * MAX_RESULT_DOCUMENT_COUNT;
+// Two edits take ten times as long to look up as one, far beyond the budget of a query
+const int MAX_EDIT_DISTANCE = 1;
+const int MAX_EXPANDED_WORDS = 32;
+// Relevance of a word found by a fuzzy query word shrinks by this factor with every edit
+const double FUZZY_EDIT_WEIGHT = 0.25;
+const int SEGMENT_DOCUMENT_COUNT = 4096;
+const int SEGMENT_MERGE_FACTOR = 4;
+// A sealed segment is rewritten without the postings of removed documents once they make up this share of it
+const double SEGMENT_REMOVED_SHARE = 0.25;
+// Work is handed to a ThreadPool in pieces of at least this size
+const size_t POSTINGS_GRAIN_SIZE = 4096;
+const size_t WORDS_GRAIN_SIZE = 64;
+const size_t DOCUMENTS_GRAIN_SIZE = 32;
+
+// Keeping word positions enables "quoted phrase" queries and proximity ranking
+// at the cost of an extra posting list per document and word.
+enum class WordPositions {
+    DISCARD,
+    STORE,
+};
 
 class SearchServer {
 public:
+    using MathedDocuments = std::tuple<std::vector<std::string_view>, DocumentStatus>;
+
+    // Result of matching one query against many documents. Words of the i-th
+    // document are words[matched_word_indices[i * words.size() + j]]
+    // for j < matched_counts[i].
+    struct BatchMatch {
+        std::vector<std::string_view> words;
+        std::vector<DocumentStatus> statuses;
+        std::vector<int> matched_counts;
+        std::vector<int> matched_word_indices;
+    };
+
     template <typename StringContainer>
-    explicit SearchServer(const StringContainer& stop_words);
+    explicit SearchServer(const StringContainer& stop_words,
+                          WordPositions word_positions = WordPositions::DISCARD);
 
-    explicit SearchServer(const std::string& stop_words_text);
+    explicit SearchServer(const std::string& stop_words_text,
+                          WordPositions word_positions = WordPositions::DISCARD);
 
-    explicit SearchServer(const char* stop_words_text);
+    explicit SearchServer(const std::string_view& stop_words_text,
+                          WordPositions word_positions = WordPositions::DISCARD);
 
-    void AddDocument(int document_id, const std::string& document, DocumentStatus status,
+    explicit SearchServer(const char* stop_words_text,
+                          WordPositions word_positions = WordPositions::DISCARD);
+
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status,
                      const std::vector<int>& ratings);
 
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(const std::string& raw_query,
-                                      DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query,
+                                           DocumentPredicate document_predicate) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query,
+                                           DocumentStatus status) const;
+
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+                                           const std::string_view raw_query,
+                                           DocumentPredicate document_predicate) const;
+
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+                                           const std::string_view raw_query,
+                                           DocumentStatus status) const;
+
+    std::vector<Document> FindTopDocuments(const std::execution::parallel_policy& policy,
+                                           const std::string_view raw_query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                           const std::string_view raw_query,
+                                           DocumentPredicate document_predicate) const;
 
-    std::vector<Document> FindTopDocuments(const std::string& raw_query,
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                           const std::string_view raw_query,
                                            DocumentStatus status) const;
 
-    std::vector<Document> FindTopDocuments(const std::string& raw_query) const;
+    std::vector<Document> FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                           const std::string_view raw_query) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ThreadPool& pool,
+                                           const std::string_view raw_query,
+                                           DocumentPredicate document_predicate) const;
+
+    std::vector<Document> FindTopDocuments(ThreadPool& pool,
+                                           const std::string_view raw_query,
+                                           DocumentStatus status) const;
+
+    std::vector<Document> FindTopDocuments(ThreadPool& pool,
+                                           const std::string_view raw_query) const;
 
     int GetDocumentCount() const;
 
-    const std::map<std::string, double>& GetWordFrequencies(int document_id) const;
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
     void RemoveDocument(int document_id);
 
+    void RemoveDocument(const std::execution::parallel_policy& policy, int document_id);
+
+    void RemoveDocument(const std::execution::sequenced_policy& policy, int document_id);
+
+    void RemoveDocument(ThreadPool& pool, int document_id);
+
     std::set<int>::const_iterator begin();
 
     std::set<int>::const_iterator end();
 
-    std::tuple<std::vector<std::string>, DocumentStatus> MatchDocument(const std::string& raw_query,
-                                                        int document_id) const;
+    MathedDocuments MatchDocument(const std::string_view& raw_query, int document_id) const;
+
+    MathedDocuments MatchDocument(const std::execution::sequenced_policy& policy,
+                                  const std::string_view& raw_query,
+                                  int document_id) const;
+
+    MathedDocuments MatchDocument(const std::execution::parallel_policy& policy,
+                                  const std::string_view& raw_query,
+                                  int document_id) const;
+
+    MathedDocuments MatchDocument(ThreadPool& pool,
+                                  const std::string_view& raw_query,
+                                  int document_id) const;
+
+    BatchMatch MatchDocuments(const std::string_view raw_query,
+                              const std::vector<int>& document_ids) const;
+
+    BatchMatch MatchDocuments(const std::execution::sequenced_policy& policy,
+                              const std::string_view raw_query,
+                              const std::vector<int>& document_ids) const;
+
+    BatchMatch MatchDocuments(const std::execution::parallel_policy& policy,
+                              const std::string_view raw_query,
+                              const std::vector<int>& document_ids) const;
+
+    BatchMatch MatchDocuments(ThreadPool& pool,
+                              const std::string_view raw_query,
+                              const std::vector<int>& document_ids) const;
 private:
+    // Generation of the documents which are not sealed into a segment yet
+    static constexpr int MUTABLE_GENERATION = -1;
+
     struct DocumentData {
         int rating;
         DocumentStatus status;
+        int generation = MUTABLE_GENERATION;
+    };
+
+    // Relevance of (document, query word index) pairs collected by a ThreadPool query
+    using RelevanceEntries = std::vector<std::tuple<int, size_t, double>>;
+
+    struct RelevanceScratch {
+        std::vector<RelevanceEntries> worker_relevance;
+        RelevanceEntries relevance;
     };
 
-    const std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string, double>> document_to_word_freqs_;
+    const StopWordSet stop_words_;
+    const WordPositions word_positions_;
+    TermDictionary documents_words_;
+    // Number of documents with the word for every indexed word, keys are the stable views of words
+    std::map<std::string_view, int> word_to_document_count_;
+    // Mutable segment: postings of the documents added since the last sealing
+    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
+    // Live documents of the mutable segment, it is sealed once they reach SEGMENT_DOCUMENT_COUNT
+    int mutable_document_count_ = 0;
+    struct SealedSegment {
+        std::shared_ptr<const IndexSegment> index;
+        // Removed documents whose postings are still in the segment
+        int removed_document_count = 0;
+    };
+
+    // Sealed segments in the order of their generations. Only merges run in the
+    // background: adding and removing documents must not overlap any other
+    // call, so callers synchronize writes with queries themselves
+    std::vector<SealedSegment> segments_;
+    int next_generation_ = 0;
+    std::future<std::shared_ptr<const IndexSegment>> merged_segment_;
+    // Removed documents of the segments being merged, counted when the merge started
+    int merge_removed_document_count_ = 0;
+    // Scratches of ThreadPool queries not taken by a running query
+    mutable std::mutex relevance_scratch_mutex_;
+    mutable std::vector<std::unique_ptr<RelevanceScratch>> free_relevance_scratches_;
+    std::map<int, std::map<std::string_view, double>> document_to_word_freqs_;
+    std::map<std::string_view, PositionPostings> word_to_document_positions_;
     std::map<int, DocumentData> documents_;
     std::set<int> document_ids_;
 
-    bool IsStopWord(const std::string& word) const;
+    bool IsStopWord(const std::string_view word) const;
 
-    static bool IsValidWord(const std::string& word);
+    static bool IsValidWord(const std::string_view& word);
 
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string& text) const;
+    std::vector<std::string_view> SplitIntoWordsNoStop(const std::string_view text) const;
 
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
     struct QueryWord {
-        std::string data;
+        std::string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(const std::string& text) const;
+    // Words are checked for control characters while being scanned, so the
+    // result of the check comes along with the word
+    QueryWord ParseQueryWord(std::string_view word, bool has_control_chars) const;
+
+    // Returns the end of the word starting at pos: a space, a quote or the end of text
+    static size_t ScanQueryWord(const std::string_view text, size_t pos, bool& has_control_chars);
+
+    // "word*" stands for the words with this prefix and "word~N" for the words
+    // within N <= MAX_EDIT_DISTANCE edits (one if N is omitted). A plus word
+    // stands for at most MAX_EXPANDED_WORDS of them, the closest first, while a
+    // minus word excludes all of them
+    static bool IsExpandableWord(const std::string_view word);
+
+    struct WordExpansion {
+        std::string_view data;
+        // Share of the relevance of the index word the document gets
+        double weight;
+    };
+
+    std::vector<WordExpansion> ExpandQueryWord(const std::string_view word, size_t max_count) const;
+
+    // Expandable plus word of a query. However many index words it stands for,
+    // it counts as one query word: a document gets the relevance of its best
+    // expansion only
+    struct ExpandedWord {
+        std::string_view data;
+        std::vector<WordExpansion> expansions;
+    };
+
+    struct PhraseWord {
+        std::string_view data;
+        int offset;
+    };
+
+    using Phrase = std::vector<PhraseWord>;
+
+    // Typical queries fit into the inline part, so parsing them doesn't allocate
+    using QueryWords = InlineVector<std::string_view, 16>;
 
+    // Words are sorted and unique, expanded words are sorted and unique by their data
     struct Query {
-        std::set<std::string> plus_words;
-        std::set<std::string> minus_words;
+        // Plus words which are not expandable
+        QueryWords plus_words;
+        // Expandable minus words are replaced with their expansions
+        QueryWords minus_words;
+        std::vector<ExpandedWord> expanded_words;
+        std::vector<Phrase> phrases;
     };
 
-    Query ParseQuery(const std::string& text) const;
+    Query ParseQuery(const std::string_view text) const;
+
+    // Plus words along with the expansions of the expanded words, sorted and unique
+    static QueryWords CollectPlusWords(const Query& query);
+
+    void AddQueryWord(const QueryWord& query_word, Query& query) const;
+
+    // Parses the phrase starting right after the opening quote at pos,
+    // returns the position after the closing quote
+    size_t ParsePhrase(const std::string_view text, size_t pos, Query& query) const;
+
+    void IndexWordPositions(int document_id, const std::string_view document);
+
+    // Empty if the document doesn't contain the word
+    EncodedPositions FindWordPositions(const std::string_view word, int document_id) const;
+
+    bool MatchesPhrases(const std::vector<Phrase>& phrases, int document_id) const;
+
+    // Share of the relevance added for the query words standing close in the
+    // document, the expansions of an expanded word counting as the same word
+    double ComputeProximityBonus(const Query& query, int document_id) const;
+
+    // Drops documents missing query phrases and rewards the best candidates with close query words
+    void ApplyWordPositions(const Query& query, std::map<int, double>& document_to_relevance) const;
 
     // Existence required
-    double ComputeWordInverseDocumentFreq(const std::string& word) const;
+    double ComputeWordInverseDocumentFreq(const std::string_view word) const;
+
+    // Erases the words without documents left from the index, they stay in the dictionary only
+    void EraseUnusedWords(const std::vector<std::string_view>& words);
+
+    // Accounts for a removed document of the sealed segment covering generation
+    void CountRemovedDocument(int generation);
+
+    void SealMutableSegment();
+
+    // Merges in the background SEGMENT_MERGE_FACTOR adjacent segments of the same size, if there are any.
+    // Otherwise rewrites a segment with at least SEGMENT_REMOVED_SHARE of its documents removed
+    void StartSegmentsMerge();
+
+    // Merges segments [first, last) in the background
+    void StartSegmentsMerge(size_t first, size_t last);
+
+    // Replaces the merged segments with the result of the background merge once it is ready
+    void CollectMergedSegment();
+
+    // Calls action(document_id, term_freq, document_data) for every live document with the word
+    template <typename Action>
+    void ForEachDocumentWithWord(const std::string_view word, Action action) const;
+
+    template <typename Action>
+    void ForEachLiveDocument(const IndexSegment& segment, const IndexSegment::Posting* first,
+                             const IndexSegment::Posting* last, Action action) const;
+
+    // Relevance gained by the documents accepted by document_predicate from an expanded word
+    template <typename DocumentPredicate>
+    std::map<int, double> ComputeExpandedWordRelevance(const ExpandedWord& expanded_word,
+                                                       DocumentPredicate document_predicate) const;
+
+    // Postings of an index word evaluated as one task: all of its mutable
+    // segment postings or a slice of its postings in a sealed segment
+    struct PostingsSlice {
+        // Index of the query word among the plus words followed by the expanded words
+        size_t query_word_index;
+        double weight;
+        double inverse_document_freq;
+        const std::map<int, double>* mutable_postings;
+        const IndexSegment* segment;
+        const IndexSegment::Posting* first;
+        const IndexSegment::Posting* last;
+    };
+
+    std::vector<PostingsSlice> SlicePostings(const Query& query) const;
+
+    // Puts the scratch back to the free list of the server once the query is done with it
+    struct RelevanceScratchReturn {
+        const SearchServer* server;
+
+        void operator()(RelevanceScratch* scratch) const;
+    };
+
+    using RelevanceScratchPtr = std::unique_ptr<RelevanceScratch, RelevanceScratchReturn>;
+
+    // Queries running at the same time take different scratches. A scratch is
+    // cleared for the next query rather than freed, so the buffers keep their
+    // capacity and steady-state queries don't allocate them
+    RelevanceScratchPtr TakeRelevanceScratch(size_t worker_count) const;
+
+    template <typename ExecutionPolicy, typename Function>
+    static void ForEachDocumentIndex(const ExecutionPolicy& policy, const std::vector<int>& document_ids,
+                                     Function function);
+
+    template <typename Function>
+    static void ForEachDocumentIndex(ThreadPool& pool, const std::vector<int>& document_ids,
+                                     Function function);
+
+    template <typename Executor>
+    BatchMatch MatchDocumentsBatch(Executor& executor,
+                                   const std::string_view raw_query,
+                                   const std::vector<int>& document_ids) const;
 
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(const Query& query,
-                                      DocumentPredicate document_predicate) const;
+                                           DocumentPredicate document_predicate) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(const std::execution::parallel_policy& policy,
+                                           const Query& query,
+                                           DocumentPredicate document_predicate) const;
+
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(ThreadPool& pool,
+                                           const Query& query,
+                                           DocumentPredicate document_predicate) const;
+
+    static void SortAndCutTopDocuments(std::vector<Document>& matched_documents);
 };
 
 //===============TEMPLATES=================================
 
 template <typename StringContainer>
-SearchServer::SearchServer(const StringContainer& stop_words)
+SearchServer::SearchServer(const StringContainer& stop_words, WordPositions word_positions)
     : stop_words_(MakeUniqueNonEmptyStrings(stop_words))  // Extract non-empty stop words
+    , word_positions_(word_positions)
 {
     if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid");
@@ -102,53 +412,80 @@ SearchServer::SearchServer(const StringContainer& stop_words)
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindTopDocuments(const std::string& raw_query,
-                                  DocumentPredicate document_predicate) const {
+std::vector<Document> SearchServer::FindTopDocuments(const std::string_view raw_query,
+                                                     DocumentPredicate document_predicate) const {
     const auto query = ParseQuery(raw_query);
 
     auto matched_documents = FindAllDocuments(query, document_predicate);
 
-    std::sort(matched_documents.begin(), matched_documents.end(),
-         [](const Document& lhs, const Document& rhs) {
-             if (std::abs(lhs.relevance - rhs.relevance) < EPSILON) {
-                 return lhs.rating > rhs.rating;
-             } else {
-                 return lhs.relevance > rhs.relevance;
-             }
-         });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
-    }
+    SortAndCutTopDocuments(matched_documents);
+
+    return matched_documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::parallel_policy& policy,
+                                                     const std::string_view raw_query,
+                                                     DocumentPredicate document_predicate) const {
+    const auto query = ParseQuery(raw_query);
+
+    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
+
+    SortAndCutTopDocuments(matched_documents);
+
+    return matched_documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const std::execution::sequenced_policy& policy,
+                                                     const std::string_view raw_query,
+                                                     DocumentPredicate document_predicate) const {
+    return FindTopDocuments(raw_query, document_predicate);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ThreadPool& pool,
+                                                     const std::string_view raw_query,
+                                                     DocumentPredicate document_predicate) const {
+    const auto query = ParseQuery(raw_query);
+
+    auto matched_documents = FindAllDocuments(pool, query, document_predicate);
+
+    SortAndCutTopDocuments(matched_documents);
 
     return matched_documents;
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
-                                  DocumentPredicate document_predicate) const {
+                                                     DocumentPredicate document_predicate) const {
     std::map<int, double> document_to_relevance;
-    for (const std::string& word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+    for (const std::string_view word : query.plus_words) {
+        const auto count_it = word_to_document_count_.find(word);
+        if (count_it == word_to_document_count_.end() || count_it->second == 0) {
             continue;
         }
         const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
+        ForEachDocumentWithWord(word, [&](int document_id, double term_freq, const DocumentData& document_data) {
             if (document_predicate(document_id, document_data.status, document_data.rating)) {
                 document_to_relevance[document_id] += term_freq * inverse_document_freq;
             }
+        });
+    }
+    for (const ExpandedWord& expanded_word : query.expanded_words) {
+        for (const auto [document_id, relevance] : ComputeExpandedWordRelevance(expanded_word, document_predicate)) {
+            document_to_relevance[document_id] += relevance;
         }
     }
 
-    for (const std::string& word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
+    for (const std::string_view word : query.minus_words) {
+        ForEachDocumentWithWord(word, [&document_to_relevance](int document_id, double, const DocumentData&) {
             document_to_relevance.erase(document_id);
-        }
+        });
     }
 
+    ApplyWordPositions(query, document_to_relevance);
+
     std::vector<Document> matched_documents;
     for (const auto [document_id, relevance] : document_to_relevance) {
         matched_documents.push_back(
@@ -157,4 +494,245 @@ std::vector<Document> SearchServer::FindAllDocuments(const Query& query,
     return matched_documents;
 }
 
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy& policy,
+                                                     const Query& query,
+                                                     DocumentPredicate document_predicate) const {
+    ConcurrentMap<int, double> document_to_relevance(100);
+
+    std::for_each(policy, query.plus_words.begin(), query.plus_words.end(),
+                  [&](const std::string_view word) {
+                      const auto count_it = word_to_document_count_.find(word);
+                      if (count_it == word_to_document_count_.end() || count_it->second == 0) {
+                          return;
+                      }
+                      const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
+                      ForEachDocumentWithWord(word, [&](int document_id, double term_freq,
+                                                        const DocumentData& document_data) {
+                          if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                              document_to_relevance[document_id].ref_to_value += term_freq * inverse_document_freq;
+                          }
+                      });
+                  });
+    std::for_each(policy, query.expanded_words.begin(), query.expanded_words.end(),
+                  [&](const ExpandedWord& expanded_word) {
+                      for (const auto [document_id, relevance] :
+                           ComputeExpandedWordRelevance(expanded_word, document_predicate)) {
+                          document_to_relevance[document_id].ref_to_value += relevance;
+                      }
+                  });
+
+    std::for_each(policy, query.minus_words.begin(), query.minus_words.end(),
+                  [&](const std::string_view word) {
+                      ForEachDocumentWithWord(word, [&document_to_relevance](int document_id, double,
+                                                                             const DocumentData&) {
+                          document_to_relevance.Erase(document_id);
+                      });
+                  });
+
+    std::map<int, double> ordinary_document_to_relevance = document_to_relevance.BuildOrdinaryMap();
+    ApplyWordPositions(query, ordinary_document_to_relevance);
+
+    std::vector<Document> matched_documents;
+    for (const auto [document_id, relevance] : ordinary_document_to_relevance) {
+        matched_documents.push_back(
+            {document_id, relevance, documents_.at(document_id).rating});
+    }
+    return matched_documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(ThreadPool& pool,
+                                                     const Query& query,
+                                                     DocumentPredicate document_predicate) const {
+    // Queries with few postings are cheaper to evaluate in the calling thread
+    size_t postings_count = 0;
+    for (const std::string_view word : CollectPlusWords(query)) {
+        const auto count_it = word_to_document_count_.find(word);
+        if (count_it != word_to_document_count_.end()) {
+            postings_count += count_it->second;
+        }
+    }
+    if (postings_count <= POSTINGS_GRAIN_SIZE) {
+        return FindAllDocuments(query, document_predicate);
+    }
+
+    // Every worker adds up relevance in its own buffer, no locking needed
+    const std::vector<PostingsSlice> slices = SlicePostings(query);
+    const RelevanceScratchPtr scratch = TakeRelevanceScratch(pool.GetWorkerCount());
+    pool.ParallelFor(slices.size(), 1, [&](size_t index, size_t worker_index) {
+        const PostingsSlice& slice = slices[index];
+        RelevanceEntries& relevance = scratch->worker_relevance[worker_index];
+        const auto add_relevance = [&](int document_id, double term_freq, const DocumentData& document_data) {
+            if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                relevance.push_back({document_id, slice.query_word_index,
+                                     slice.weight * term_freq * slice.inverse_document_freq});
+            }
+        };
+        if (slice.segment == nullptr) {
+            for (const auto [document_id, term_freq] : *slice.mutable_postings) {
+                add_relevance(document_id, term_freq, documents_.at(document_id));
+            }
+        } else {
+            ForEachLiveDocument(*slice.segment, slice.first, slice.last, add_relevance);
+        }
+    });
+
+    // Sorted by value as well, so that the sums don't depend on the scheduling.
+    // Of the expansions of a query word found in a document, the best one is the last
+    RelevanceEntries& relevance = scratch->relevance;
+    for (const RelevanceEntries& worker_part : scratch->worker_relevance) {
+        relevance.insert(relevance.end(), worker_part.begin(), worker_part.end());
+    }
+    std::sort(relevance.begin(), relevance.end());
+    std::map<int, double> document_to_relevance;
+    for (size_t i = 0; i < relevance.size(); ++i) {
+        const auto& [document_id, query_word_index, document_relevance] = relevance[i];
+        if (i + 1 < relevance.size() && std::get<0>(relevance[i + 1]) == document_id
+            && std::get<1>(relevance[i + 1]) == query_word_index) {
+            continue;
+        }
+        if (!document_to_relevance.empty() && document_to_relevance.rbegin()->first == document_id) {
+            document_to_relevance.rbegin()->second += document_relevance;
+        } else {
+            document_to_relevance.emplace_hint(document_to_relevance.end(), document_id, document_relevance);
+        }
+    }
 
+    for (const std::string_view word : query.minus_words) {
+        ForEachDocumentWithWord(word, [&document_to_relevance](int document_id, double, const DocumentData&) {
+            document_to_relevance.erase(document_id);
+        });
+    }
+
+    ApplyWordPositions(query, document_to_relevance);
+
+    std::vector<Document> matched_documents;
+    for (const auto [document_id, document_relevance] : document_to_relevance) {
+        matched_documents.push_back(
+            {document_id, document_relevance, documents_.at(document_id).rating});
+    }
+    return matched_documents;
+}
+
+template <typename ExecutionPolicy, typename Function>
+void SearchServer::ForEachDocumentIndex(const ExecutionPolicy& policy, const std::vector<int>& document_ids,
+                                        Function function) {
+    std::for_each(policy, document_ids.begin(), document_ids.end(),
+                  [&](const int& document_id) {
+                      function(&document_id - document_ids.data());
+                  });
+}
+
+template <typename Function>
+void SearchServer::ForEachDocumentIndex(ThreadPool& pool, const std::vector<int>& document_ids,
+                                        Function function) {
+    pool.ParallelFor(document_ids.size(), DOCUMENTS_GRAIN_SIZE, [&function](size_t index, size_t) {
+        function(index);
+    });
+}
+
+template <typename Executor>
+SearchServer::BatchMatch SearchServer::MatchDocumentsBatch(Executor& executor,
+                                                           const std::string_view raw_query,
+                                                           const std::vector<int>& document_ids) const {
+    for (const int document_id : document_ids) {
+        if (document_to_word_freqs_.count(document_id) == 0) {
+            throw std::out_of_range("No document with id = " + std::to_string(document_id));
+        }
+    }
+
+    const Query query = ParseQuery(raw_query);
+
+    // Words missing from the index can't match anything, the rest are
+    // referenced by the index keys so that they outlive the query text
+    BatchMatch result;
+    for (const std::string_view word : CollectPlusWords(query)) {
+        const auto it = word_to_document_count_.find(word);
+        if (it != word_to_document_count_.end() && it->second > 0) {
+            result.words.push_back(it->first);
+        }
+    }
+    std::vector<std::string_view> minus_words;
+    for (const std::string_view word : query.minus_words) {
+        const auto it = word_to_document_count_.find(word);
+        if (it != word_to_document_count_.end() && it->second > 0) {
+            minus_words.push_back(word);
+        }
+    }
+
+    const size_t words_count = result.words.size();
+    result.statuses.resize(document_ids.size());
+    result.matched_counts.resize(document_ids.size());
+    result.matched_word_indices.resize(document_ids.size() * words_count);
+
+    ForEachDocumentIndex(executor, document_ids,
+                  [&](const size_t index) {
+                      const int document_id = document_ids[index];
+                      const auto& words_map = document_to_word_freqs_.at(document_id);
+                      result.statuses[index] = documents_.at(document_id).status;
+
+                      const bool has_minus_word = std::any_of(minus_words.begin(), minus_words.end(),
+                                                              [&words_map](const std::string_view word) {
+                                                                  return words_map.count(word) > 0;
+                                                              });
+                      if (has_minus_word || !MatchesPhrases(query.phrases, document_id)) {
+                          return;
+                      }
+
+                      int* matched = result.matched_word_indices.data() + index * words_count;
+                      int count = 0;
+                      for (size_t i = 0; i < words_count; ++i) {
+                          if (words_map.count(result.words[i]) > 0) {
+                              matched[count++] = static_cast<int>(i);
+                          }
+                      }
+                      result.matched_counts[index] = count;
+                  });
+
+    return result;
+}
+
+template <typename DocumentPredicate>
+std::map<int, double> SearchServer::ComputeExpandedWordRelevance(const ExpandedWord& expanded_word,
+                                                                 DocumentPredicate document_predicate) const {
+    std::map<int, double> document_to_relevance;
+    for (const auto [word, weight] : expanded_word.expansions) {
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
+        ForEachDocumentWithWord(word, [&](int document_id, double term_freq, const DocumentData& document_data) {
+            if (document_predicate(document_id, document_data.status, document_data.rating)) {
+                double& relevance = document_to_relevance[document_id];
+                relevance = std::max(relevance, weight * term_freq * inverse_document_freq);
+            }
+        });
+    }
+    return document_to_relevance;
+}
+
+template <typename Action>
+void SearchServer::ForEachDocumentWithWord(const std::string_view word, Action action) const {
+    const auto it = word_to_document_freqs_.find(word);
+    if (it != word_to_document_freqs_.end()) {
+        for (const auto [document_id, term_freq] : it->second) {
+            action(document_id, term_freq, documents_.at(document_id));
+        }
+    }
+
+    for (const SealedSegment& segment : segments_) {
+        const auto postings = segment.index->FindPostings(word);
+        ForEachLiveDocument(*segment.index, postings.begin(), postings.end(), action);
+    }
+}
+
+template <typename Action>
+void SearchServer::ForEachLiveDocument(const IndexSegment& segment, const IndexSegment::Posting* first,
+                                       const IndexSegment::Posting* last, Action action) const {
+    for (; first != last; ++first) {
+        // Postings of removed documents stay in segments until they are merged,
+        // and an id may have been added again since then
+        const auto document_it = documents_.find(first->document_id);
+        if (document_it != documents_.end() && segment.CoversGeneration(document_it->second.generation)) {
+            action(first->document_id, first->term_freq, document_it->second);
+        }
+    }
+}
@@ -0,0 +1,123 @@
+#include "stop_word_set.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+const uint32_t MAX_DISPLACEMENT = 1 << 16;
+
+} // namespace
+
+StopWordSet::StopWordSet(std::vector<std::string> words)
+    : words_(std::move(words))
+{
+    if (words_.empty()) {
+        return;
+    }
+    for (const std::string& word : words_) {
+        lengths_ |= LengthBit(word.size());
+    }
+
+    size_t slot_count = 1;
+    while (slot_count < words_.size() + words_.size() / 4) {
+        slot_count *= 2;
+    }
+    // Words with equal hashes can't be placed whatever the displacements are,
+    // but they are told apart by the hash with another seed
+    for (int attempt = 0; !TryBuild(slot_count); ++attempt) {
+        if (attempt + 1 == MAX_BUILD_ATTEMPTS) {
+            throw std::invalid_argument("Stop words can't be hashed apart, some of them must be equal");
+        }
+        ++seed_;
+        slot_count *= 2;
+    }
+}
+
+bool StopWordSet::Contains(std::string_view word) const {
+    if ((lengths_ & LengthBit(word.size())) == 0) {
+        return false;
+    }
+    const uint64_t hash = Hash(word, seed_);
+    const int index = slots_[GetSlot(hash, displacements_[hash % displacements_.size()])];
+    return index != NO_WORD && words_[index] == word;
+}
+
+std::vector<std::string>::const_iterator StopWordSet::begin() const {
+    return words_.begin();
+}
+
+std::vector<std::string>::const_iterator StopWordSet::end() const {
+    return words_.end();
+}
+
+// FNV-1a, the seed changing the offset basis
+uint64_t StopWordSet::Hash(std::string_view word, uint64_t seed) {
+    uint64_t hash = 14695981039346656037ull ^ (seed * 0x9E3779B97F4A7C15ull);
+    for (const char c : word) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+size_t StopWordSet::GetSlot(uint64_t hash, uint32_t displacement) const {
+    uint64_t mixed = hash ^ (displacement * 0x9E3779B97F4A7C15ull);
+    mixed ^= mixed >> 31;
+    mixed *= 0xBF58476D1CE4E5B9ull;
+    mixed ^= mixed >> 29;
+    return mixed & (slots_.size() - 1);
+}
+
+uint64_t StopWordSet::LengthBit(size_t length) {
+    return uint64_t{1} << std::min<size_t>(length, 63);
+}
+
+bool StopWordSet::TryBuild(size_t slot_count) {
+    slots_.assign(slot_count, NO_WORD);
+    displacements_.assign(words_.size() / 4 + 1, 0);
+
+    std::vector<uint64_t> hashes(words_.size());
+    std::vector<std::vector<int>> buckets(displacements_.size());
+    for (size_t i = 0; i < words_.size(); ++i) {
+        hashes[i] = Hash(words_[i], seed_);
+        buckets[hashes[i] % buckets.size()].push_back(static_cast<int>(i));
+    }
+
+    // Large buckets are the hardest to place, so they go first while the table is empty
+    std::vector<size_t> order(buckets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&buckets](size_t lhs, size_t rhs) {
+        return buckets[lhs].size() > buckets[rhs].size();
+    });
+
+    std::vector<size_t> bucket_slots;
+    for (const size_t bucket : order) {
+        bool is_placed = false;
+        for (uint32_t displacement = 0; !is_placed && displacement < MAX_DISPLACEMENT; ++displacement) {
+            bucket_slots.clear();
+            is_placed = true;
+            for (const int word : buckets[bucket]) {
+                const size_t slot = GetSlot(hashes[word], displacement);
+                if (slots_[slot] != NO_WORD
+                    || std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end()) {
+                    is_placed = false;
+                    break;
+                }
+                bucket_slots.push_back(slot);
+            }
+            if (is_placed) {
+                for (size_t i = 0; i < bucket_slots.size(); ++i) {
+                    slots_[bucket_slots[i]] = buckets[bucket][i];
+                }
+                displacements_[bucket] = displacement;
+            }
+        }
+        if (!is_placed) {
+            return false;
+        }
+    }
+    return true;
+}
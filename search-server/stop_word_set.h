@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Immutable set of stop words compiled into a perfect hash table by hash and
+// displace: words are grouped into buckets by their hash, and every bucket
+// gets a displacement picked at construction so that no two words share a
+// slot. A lookup is a length check, one pass of hashing over the word and at
+// most one comparison.
+class StopWordSet {
+public:
+    StopWordSet() = default;
+
+    // Words must be unique: equal words hash alike with every seed, so the table
+    // can't be built and std::invalid_argument is thrown
+    explicit StopWordSet(std::vector<std::string> words);
+
+    bool Contains(std::string_view word) const;
+
+    std::vector<std::string>::const_iterator begin() const;
+
+    std::vector<std::string>::const_iterator end() const;
+
+private:
+    static constexpr int NO_WORD = -1;
+    // Every attempt hashes with another seed into a twice larger table
+    static constexpr int MAX_BUILD_ATTEMPTS = 4;
+
+    std::vector<std::string> words_;
+    std::vector<uint32_t> displacements_;
+    std::vector<int> slots_;
+    uint64_t seed_ = 0;
+    // Bit i is set if there is a word of length i, the last bit covers longer words
+    uint64_t lengths_ = 0;
+
+    static uint64_t Hash(std::string_view word, uint64_t seed);
+
+    size_t GetSlot(uint64_t hash, uint32_t displacement) const;
+
+    static uint64_t LengthBit(size_t length);
+
+    bool TryBuild(size_t slot_count);
+};
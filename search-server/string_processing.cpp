@@ -1,21 +1,19 @@
 #include "string_processing.h"
 
-std::vector<std::string> SplitIntoWords(const std::string& text) {
-    std::vector<std::string> words;
-    std::string word;
-    for (const char c : text) {
-        if (c == ' ') {
-            if (!word.empty()) {
-                words.push_back(word);
-                word.clear();
-            }
-        } else {
-            word += c;
+std::vector<std::string_view> SplitIntoWords(std::string_view text) {
+    std::vector<std::string_view> words;
+    while (true) {
+        const auto begin = text.find_first_not_of(' ');
+        if (begin == text.npos) {
+            break;
         }
-    }
-    if (!word.empty()) {
-        words.push_back(word);
+        text.remove_prefix(begin);
+        const auto end = text.find(' ');
+        words.push_back(text.substr(0, end));
+        if (end == text.npos) {
+            break;
+        }
+        text.remove_prefix(end);
     }
     return words;
 }
-
@@ -0,0 +1,386 @@
+#include "term_dictionary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+// Terms are ordered like std::string_view does it, that is by unsigned bytes
+bool CharLess(char lhs, char rhs) {
+    return static_cast<unsigned char>(lhs) < static_cast<unsigned char>(rhs);
+}
+
+bool StartsWith(std::string_view text, std::string_view prefix) {
+    return text.substr(0, prefix.size()) == prefix;
+}
+
+template <typename Predicate>
+size_t PartitionPoint(size_t first, size_t last, Predicate predicate) {
+    while (first < last) {
+        const size_t middle = first + (last - first) / 2;
+        if (predicate(middle)) {
+            first = middle + 1;
+        } else {
+            last = middle;
+        }
+    }
+    return first;
+}
+
+// Same as PartitionPoint, but probes the range from its beginning with growing
+// steps: cheaper and more cache friendly when the point is close, which is the
+// usual case for trie children
+template <typename Predicate>
+size_t GallopPartitionPoint(size_t first, size_t last, Predicate predicate) {
+    size_t step = 1;
+    while (last - first > step && predicate(first + step)) {
+        first += step;
+        step *= 2;
+    }
+    return PartitionPoint(first, std::min(first + step, last), predicate);
+}
+
+} // namespace
+
+TermDictionary::RunTerms::RunTerms(const TermDictionary& dictionary, const Run& run)
+    : dictionary_(dictionary)
+    , run_(run)
+{
+}
+
+size_t TermDictionary::RunTerms::size() const {
+    return run_.size();
+}
+
+std::string_view TermDictionary::RunTerms::operator[](size_t index) const {
+    return dictionary_.GetTerm(run_[index].ref);
+}
+
+char TermDictionary::RunTerms::CharAt(size_t index, size_t depth) const {
+    const RunEntry& entry = run_[index];
+    return depth < KEY_SIZE ? entry.key[depth] : dictionary_.GetTerm(entry.ref)[depth];
+}
+
+bool TermDictionary::RunTerms::HasLength(size_t index, size_t length) const {
+    const RunEntry& entry = run_[index];
+    return length < KEY_SIZE ? entry.key[length] == '\0' : dictionary_.GetTerm(entry.ref).size() == length;
+}
+
+size_t TermDictionary::RunTerms::LowerBound(std::string_view term) const {
+    return PartitionPoint(0, size(), [this, term](size_t index) {
+        return (*this)[index] < term;
+    });
+}
+
+std::string_view TermDictionary::Add(std::string_view term) {
+    const TermRef ref = Store(term);
+    const size_t index = RunTerms(*this, buffer_).LowerBound(term);
+    buffer_.insert(buffer_.begin() + index, MakeEntry(ref, term));
+    ++size_;
+    if (buffer_.size() >= MAX_BUFFER_SIZE) {
+        FlushBuffer();
+    }
+    return GetTerm(ref);
+}
+
+std::string_view TermDictionary::Find(std::string_view term) const {
+    const auto find = [this, term](const Run& run) -> std::string_view {
+        const RunTerms terms(*this, run);
+        const size_t index = terms.LowerBound(term);
+        return index < terms.size() && terms[index] == term ? terms[index] : std::string_view();
+    };
+    for (const Run& run : runs_) {
+        if (const std::string_view stored = find(run); stored.data() != nullptr) {
+            return stored;
+        }
+    }
+    return find(buffer_);
+}
+
+bool TermDictionary::Contains(std::string_view term) const {
+    return Find(term).data() != nullptr;
+}
+
+size_t TermDictionary::size() const {
+    return size_;
+}
+
+std::vector<std::string_view> TermDictionary::FindByPrefix(std::string_view prefix, size_t max_count,
+                                                           const TermFilter& filter) const {
+    std::vector<std::string_view> result;
+    CollectByPrefix(RunTerms(*this, buffer_), prefix, max_count, filter, result);
+    for (const Run& run : runs_) {
+        std::vector<std::string_view> run_terms;
+        CollectByPrefix(RunTerms(*this, run), prefix, max_count, filter, run_terms);
+
+        std::vector<std::string_view> merged;
+        std::merge(result.begin(), result.end(), run_terms.begin(), run_terms.end(),
+                   std::back_inserter(merged));
+        if (merged.size() > max_count) {
+            merged.resize(max_count);
+        }
+        result = std::move(merged);
+    }
+    return result;
+}
+
+std::vector<TermDictionary::SimilarTerm> TermDictionary::FindSimilar(std::string_view term, int max_distance,
+                                                                     size_t max_count,
+                                                                     const TermFilter& filter) const {
+    if (max_count == 0) {
+        return {};
+    }
+    std::vector<std::pair<int, std::string_view>> found;
+    for (const Run& run : runs_) {
+        CollectSimilar(RunTerms(*this, run), term, max_distance, max_count, filter, found);
+    }
+    CollectSimilar(RunTerms(*this, buffer_), term, max_distance, max_count, filter, found);
+
+    std::sort_heap(found.begin(), found.end());
+    std::vector<SimilarTerm> result;
+    result.reserve(found.size());
+    for (const auto& [distance, similar_term] : found) {
+        result.push_back({similar_term, distance});
+    }
+    return result;
+}
+
+TermDictionary::TermRef TermDictionary::Store(std::string_view term) {
+    char header[10];
+    size_t header_size = 0;
+    for (size_t length = term.size(); ; length >>= 7) {
+        header[header_size++] = static_cast<char>(length >= 0x80 ? (length & 0x7F) | 0x80 : length);
+        if (length < 0x80) {
+            break;
+        }
+    }
+
+    const size_t record_size = header_size + term.size();
+    if (record_size > free_end_ - free_begin_) {
+        const size_t window_count = (record_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        if (windows_.size() + window_count > (size_t{1} << 32) / CHUNK_SIZE) {
+            throw std::length_error("Term dictionary is full");
+        }
+        chunks_.push_back(std::make_unique<char[]>(window_count * CHUNK_SIZE));
+        free_begin_ = static_cast<TermRef>(windows_.size() * CHUNK_SIZE);
+        for (size_t i = 0; i < window_count; ++i) {
+            windows_.push_back(chunks_.back().get() + i * CHUNK_SIZE);
+        }
+        // The last window ends at 2^32, which is one past the largest TermRef
+        free_end_ = static_cast<TermRef>(windows_.size() * CHUNK_SIZE - 1);
+    }
+
+    const TermRef ref = free_begin_;
+    char* const data = windows_[ref / CHUNK_SIZE] + ref % CHUNK_SIZE;
+    std::memcpy(data, header, header_size);
+    std::memcpy(data + header_size, term.data(), term.size());
+    free_begin_ += static_cast<TermRef>(record_size);
+    return ref;
+}
+
+std::string_view TermDictionary::GetTerm(TermRef ref) const {
+    const char* data = windows_[ref / CHUNK_SIZE] + ref % CHUNK_SIZE;
+    size_t length = 0;
+    for (int shift = 0; ; shift += 7) {
+        const auto byte = static_cast<unsigned char>(*data++);
+        length |= static_cast<size_t>(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            break;
+        }
+    }
+    return {data, length};
+}
+
+void TermDictionary::FlushBuffer() {
+    runs_.push_back(std::move(buffer_));
+    buffer_.clear();
+    while (runs_.size() > 1 && runs_[runs_.size() - 2].size() < MERGE_FACTOR * runs_.back().size()) {
+        Run merged = MergeRuns(runs_[runs_.size() - 2], runs_.back());
+        runs_.pop_back();
+        runs_.back() = std::move(merged);
+    }
+}
+
+TermDictionary::Run TermDictionary::MergeRuns(const Run& lhs, const Run& rhs) const {
+    Run result;
+    result.reserve(lhs.size() + rhs.size());
+    std::merge(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), std::back_inserter(result),
+               [this](const RunEntry& lhs_entry, const RunEntry& rhs_entry) {
+                   return EntryLess(lhs_entry, rhs_entry);
+               });
+    return result;
+}
+
+TermDictionary::RunEntry TermDictionary::MakeEntry(TermRef ref, std::string_view term) {
+    RunEntry entry{ref, {}};
+    term.copy(entry.key, KEY_SIZE);
+    return entry;
+}
+
+bool TermDictionary::EntryLess(const RunEntry& lhs, const RunEntry& rhs) const {
+    // The padding sorts before any character of a term
+    for (size_t i = 0; i < KEY_SIZE; ++i) {
+        if (lhs.key[i] != rhs.key[i]) {
+            return CharLess(lhs.key[i], rhs.key[i]);
+        }
+    }
+    return GetTerm(lhs.ref) < GetTerm(rhs.ref);
+}
+
+void TermDictionary::CollectByPrefix(const RunTerms& terms, std::string_view prefix, size_t max_count,
+                                     const TermFilter& filter, std::vector<std::string_view>& result) {
+    size_t index = PartitionPoint(0, terms.size(), [&terms, prefix](size_t other) {
+        return terms[other] < prefix;
+    });
+    for (; index < terms.size() && result.size() < max_count && StartsWith(terms[index], prefix); ++index) {
+        if (filter(terms[index])) {
+            result.push_back(terms[index]);
+        }
+    }
+}
+
+// Walks the sorted terms as if they were a trie: a range of terms sharing a
+// prefix is a node, and its children are the subranges split by the next
+// character. Every node carries its row of the edit distance table (the state
+// of a Levenshtein automaton); a node whose row has no cell within
+// max_distance is dead together with its subtree. When a character absent from
+// the target can't keep a child alive, only the children labelled with target
+// characters are looked up.
+void TermDictionary::CollectSimilar(const RunTerms& terms, std::string_view term, int max_distance,
+                                    size_t max_count, const TermFilter& filter,
+                                    std::vector<std::pair<int, std::string_view>>& found) {
+    if (terms.size() == 0) {
+        return;
+    }
+
+    // Nothing farther than the worst of max_count found terms can make it to the result
+    const auto distance_bound = [&found, max_count, max_distance] {
+        return found.size() < max_count ? max_distance : found.front().first;
+    };
+    const auto add_found = [&found, max_count](int distance, std::string_view similar_term) {
+        const std::pair<int, std::string_view> candidate{distance, similar_term};
+        if (found.size() == max_count) {
+            if (!(candidate < found.front())) {
+                return;
+            }
+            std::pop_heap(found.begin(), found.end());
+            found.pop_back();
+        }
+        found.push_back(candidate);
+        std::push_heap(found.begin(), found.end());
+    };
+
+    std::string target_chars(term);
+    std::sort(target_chars.begin(), target_chars.end(), CharLess);
+    target_chars.erase(std::unique(target_chars.begin(), target_chars.end()), target_chars.end());
+
+    const size_t width = term.size() + 1;
+    std::vector<int> rows(width);
+    std::iota(rows.begin(), rows.end(), 0);
+
+    // Computes the row of the child labelled with c, returns false if the child is dead
+    const auto compute_row = [&](size_t depth, char c) {
+        rows.resize((depth + 2) * width);
+        const int* upper = rows.data() + depth * width;
+        int* row = rows.data() + (depth + 1) * width;
+        row[0] = static_cast<int>(depth + 1);
+        int row_min = row[0];
+        for (size_t i = 1; i < width; ++i) {
+            const int substitution = upper[i - 1] + (term[i - 1] == c ? 0 : 1);
+            row[i] = std::min({upper[i] + 1, row[i - 1] + 1, substitution});
+            row_min = std::min(row_min, row[i]);
+        }
+        return row_min <= distance_bound();
+    };
+
+    // Finishes the rows of every term in a small node one by one: locating the
+    // children would read the terms many times over. Rows of the common prefix
+    // of neighbouring terms are computed once.
+    const auto scan = [&](size_t first, size_t last, size_t depth) {
+        std::string_view previous;
+        size_t rows_depth = depth;
+        for (; first != last; ++first) {
+            const std::string_view current = terms[first];
+            size_t common = depth;
+            while (common < rows_depth && common < current.size() && previous[common] == current[common]) {
+                ++common;
+            }
+            rows_depth = common;
+            while (rows_depth < current.size() && compute_row(rows_depth, current[rows_depth])) {
+                ++rows_depth;
+            }
+            previous = current;
+            if (rows_depth < current.size()) {
+                // The row at rows_depth + 1 is dead, so it is not valid for the next term
+                continue;
+            }
+            const int distance = rows[rows_depth * width + term.size()];
+            if (distance <= distance_bound() && filter(current)) {
+                add_found(distance, current);
+            }
+        }
+    };
+
+    // Every term in [first, last) is at least depth characters long and shares the first depth of them
+    const auto visit = [&](const auto& self, size_t first, size_t last, size_t depth) -> void {
+        if (last - first <= SCAN_SIZE) {
+            scan(first, last, depth);
+            return;
+        }
+        if (terms.HasLength(first, depth)) {
+            const int distance = rows[depth * width + term.size()];
+            if (distance <= distance_bound() && filter(terms[first])) {
+                add_found(distance, terms[first]);
+            }
+            if (++first == last) {
+                return;
+            }
+        }
+
+        const auto child_end = [&terms, depth, last](size_t child_first, char c) {
+            return GallopPartitionPoint(child_first, last, [&terms, depth, c](size_t index) {
+                return !CharLess(c, terms.CharAt(index, depth));
+            });
+        };
+
+        // '\0' stands for any character the target doesn't contain: valid words have no control characters
+        const bool any_char_alive = compute_row(depth, '\0');
+        if (!any_char_alive) {
+            for (const char c : target_chars) {
+                const size_t child_first = GallopPartitionPoint(first, last, [&terms, depth, c](size_t index) {
+                    return CharLess(terms.CharAt(index, depth), c);
+                });
+                if (child_first == last) {
+                    break;
+                }
+                if (terms.CharAt(child_first, depth) != c) {
+                    first = child_first;
+                    continue;
+                }
+                const size_t child_last = child_end(child_first, c);
+                if (compute_row(depth, c)) {
+                    self(self, child_first, child_last, depth + 1);
+                }
+                first = child_last;
+                if (first == last) {
+                    break;
+                }
+            }
+            return;
+        }
+
+        while (first != last) {
+            const char c = terms.CharAt(first, depth);
+            const size_t child_last = child_end(first, c);
+            if (compute_row(depth, c)) {
+                self(self, first, child_last, depth + 1);
+            }
+            first = child_last;
+        }
+    };
+
+    visit(visit, 0, terms.size(), 0);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Sorted set of index terms.
+// Added terms are copied once into large append-only chunks, so views
+// returned by Add stay valid for the dictionary lifetime. A stored term is its
+// length as a varint followed by its characters, and it is referred to by a
+// 32-bit offset into the chunks.
+// For lookups the references are also kept in sorted runs, along with the
+// first few characters of every term: the upper levels of a search don't have
+// to visit the chunks at all. New terms land in a small sorted buffer; a full
+// buffer becomes a run, and runs are merged while a run is less than
+// MERGE_FACTOR times as large as the next one, so there are only O(log n) runs
+// to search.
+class TermDictionary {
+public:
+    // Tells whether a stored term may be returned by a search
+    using TermFilter = std::function<bool(std::string_view)>;
+
+    // Stores a term which is not in the dictionary yet and has no '\0' characters,
+    // returns the stored copy
+    std::string_view Add(std::string_view term);
+
+    // The stored copy of term, a view without data if the term is not in the dictionary
+    std::string_view Find(std::string_view term) const;
+
+    bool Contains(std::string_view term) const;
+
+    size_t size() const;
+
+    // At most max_count terms accepted by filter starting with prefix, in lexicographical order
+    std::vector<std::string_view> FindByPrefix(std::string_view prefix, size_t max_count,
+                                               const TermFilter& filter) const;
+
+    struct SimilarTerm {
+        std::string_view term;
+        int distance;
+    };
+
+    // At most max_count terms accepted by filter within max_distance edits
+    // (Levenshtein) from term, the closest first. Once max_count terms are
+    // found, the search skips everything farther than the worst of them.
+    std::vector<SimilarTerm> FindSimilar(std::string_view term, int max_distance,
+                                         size_t max_count, const TermFilter& filter) const;
+
+private:
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t MAX_BUFFER_SIZE = 1024;
+    static constexpr size_t MERGE_FACTOR = 8;
+
+    static constexpr size_t KEY_SIZE = 4;
+    // Similar terms are looked for among at most this many terms by checking each of them
+    static constexpr size_t SCAN_SIZE = 16;
+
+    // Offset of a stored term, chunks being numbered one after another
+    using TermRef = uint32_t;
+
+    struct RunEntry {
+        TermRef ref;
+        // First characters of the term padded with '\0'
+        char key[KEY_SIZE];
+    };
+
+    using Run = std::vector<RunEntry>;
+
+    // Terms of a run in their sorted order
+    class RunTerms {
+    public:
+        RunTerms(const TermDictionary& dictionary, const Run& run);
+
+        size_t size() const;
+
+        std::string_view operator[](size_t index) const;
+
+        // Character at position depth of a term longer than depth
+        char CharAt(size_t index, size_t depth) const;
+
+        bool HasLength(size_t index, size_t length) const;
+
+        // Index of the first term which is not less than term
+        size_t LowerBound(std::string_view term) const;
+
+    private:
+        const TermDictionary& dictionary_;
+        const Run& run_;
+    };
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    // Beginning of every CHUNK_SIZE bytes of the chunks: a term longer than
+    // CHUNK_SIZE gets a chunk spanning several of them
+    std::vector<char*> windows_;
+    TermRef free_begin_ = 0;
+    TermRef free_end_ = 0;
+    std::vector<Run> runs_;
+    Run buffer_;
+    size_t size_ = 0;
+
+    TermRef Store(std::string_view term);
+
+    std::string_view GetTerm(TermRef ref) const;
+
+    static RunEntry MakeEntry(TermRef ref, std::string_view term);
+
+    bool EntryLess(const RunEntry& lhs, const RunEntry& rhs) const;
+
+    void FlushBuffer();
+
+    Run MergeRuns(const Run& lhs, const Run& rhs) const;
+
+    static void CollectByPrefix(const RunTerms& terms, std::string_view prefix, size_t max_count,
+                                const TermFilter& filter, std::vector<std::string_view>& result);
+
+    // Keeps found a max-heap of at most max_count closest terms
+    static void CollectSimilar(const RunTerms& terms, std::string_view term, int max_distance,
+                               size_t max_count, const TermFilter& filter,
+                               std::vector<std::pair<int, std::string_view>>& found);
+};
@@ -0,0 +1,689 @@
+#include "test_example_functions.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::string MakeTestDocument(int document_id) {
+    return "common id"s + std::to_string(document_id) + (document_id % 2 == 0 ? " even"s : " odd"s);
+}
+
+// Element at share p of the sorted values
+double GetPercentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+// Every policy finds a document by its own word if and only if it is live
+void CheckLiveDocuments(const SearchServer& search_server, ThreadPool& pool, const std::vector<bool>& is_live) {
+    int live_count = 0;
+    for (int document_id = 0; document_id < static_cast<int>(is_live.size()); ++document_id) {
+        live_count += is_live[document_id] ? 1 : 0;
+        if (document_id % 7 != 0) {
+            continue;
+        }
+        const std::string query = "id"s + std::to_string(document_id);
+        for (const auto& documents : {search_server.FindTopDocuments(query),
+                                      search_server.FindTopDocuments(std::execution::par, query),
+                                      search_server.FindTopDocuments(pool, query)}) {
+            if (is_live[document_id]) {
+                assert(documents.size() == 1 && documents[0].id == document_id);
+            } else {
+                assert(documents.empty());
+            }
+        }
+    }
+    assert(search_server.GetDocumentCount() == live_count);
+}
+
+std::vector<int> GetDocumentIds(const std::vector<Document>& documents) {
+    std::vector<int> document_ids;
+    for (const Document& document : documents) {
+        document_ids.push_back(document.id);
+    }
+    std::sort(document_ids.begin(), document_ids.end());
+    return document_ids;
+}
+
+template <typename Function>
+void AssertThrowsInvalidArgument(Function function) {
+    try {
+        function();
+    } catch (const std::invalid_argument&) {
+        return;
+    }
+    assert(!"std::invalid_argument expected");
+}
+
+// Bytes allocated on the heap, 0 if the allocator doesn't tell
+size_t GetAllocatedBytes() {
+#ifdef __GLIBC__
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+} // namespace
+
+void TestPhrasesAndProximity() {
+    SearchServer search_server("and the is"s, WordPositions::STORE);
+    search_server.AddDocument(1, "white cat and fancy red collar"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cat is white"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(3, "fluffy cat the white cat"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(4, "cat and the collar"s, DocumentStatus::ACTUAL, {1});
+
+    const auto check_phrases = [&search_server](int white_cat_id) {
+        const std::vector<int> white_cat_ids = {std::min(white_cat_id, 3), std::max(white_cat_id, 3)};
+        assert(GetDocumentIds(search_server.FindTopDocuments("\"white cat\""s)) == white_cat_ids);
+        // Stop words are not indexed, but they keep their places in a phrase
+        assert(GetDocumentIds(search_server.FindTopDocuments("\"cat and the collar\""s)) == std::vector<int>{4});
+        assert(search_server.FindTopDocuments("\"cat collar\""s).empty());
+        assert(search_server.FindTopDocuments("\"fancy white\""s).empty());
+    };
+    check_phrases(1);
+    assert(search_server.FindTopDocuments("\"cat white\""s).empty());
+
+    AssertThrowsInvalidArgument([&search_server] {
+        search_server.FindTopDocuments("\"white cat"s);
+    });
+    AssertThrowsInvalidArgument([&search_server] {
+        search_server.FindTopDocuments("\"white -cat\""s);
+    });
+    AssertThrowsInvalidArgument([] {
+        SearchServer discarding_server("and"s);
+        discarding_server.AddDocument(1, "white cat"s, DocumentStatus::ACTUAL, {1});
+        discarding_server.FindTopDocuments("\"white cat\""s);
+    });
+
+    // Positions of sealed documents are found the same way
+    for (int document_id = 5; document_id < 5 + SEGMENT_DOCUMENT_COUNT; ++document_id) {
+        search_server.AddDocument(document_id, "filler text"s, DocumentStatus::ACTUAL, {1});
+    }
+    check_phrases(1);
+
+    // An id added again has the positions of its new words only
+    search_server.RemoveDocument(1);
+    search_server.AddDocument(1, "cat white and fancy red collar"s, DocumentStatus::ACTUAL, {1});
+    assert(GetDocumentIds(search_server.FindTopDocuments("\"cat white\""s)) == std::vector<int>{1});
+    assert(GetDocumentIds(search_server.FindTopDocuments("\"white cat\""s)) == std::vector<int>{3});
+
+    // Same words, so the same relevance without positions: only the distance differs
+    SearchServer proximity_server("and"s, WordPositions::STORE);
+    proximity_server.AddDocument(1, "red one two three apple"s, DocumentStatus::ACTUAL, {5});
+    proximity_server.AddDocument(2, "red apple one two three"s, DocumentStatus::ACTUAL, {1});
+    proximity_server.AddDocument(3, "green tree"s, DocumentStatus::ACTUAL, {1});
+    const std::vector<Document> documents = proximity_server.FindTopDocuments("red apple"s);
+    assert(documents.size() == 2 && documents[0].id == 2 && documents[1].id == 1);
+    assert(documents[0].relevance > documents[1].relevance);
+
+    std::cout << "TestPhrasesAndProximity OK"s << std::endl;
+}
+
+void TestStopWordsAndQueryParsing() {
+    // Words of 63 bytes and longer share the last length bit, so they are told apart by comparison
+    const std::string long_word(63, 'x');
+    const std::string longer_word(70, 'x');
+    const StopWordSet stop_words({"a"s, "and"s, "the"s, "in"s, long_word, longer_word});
+    for (const std::string_view word : {"a"sv, "and"sv, "the"sv, "in"sv, std::string_view(long_word),
+                                        std::string_view(longer_word)}) {
+        assert(stop_words.Contains(word));
+    }
+    for (const std::string_view word : {""sv, "an"sv, "thee"sv, "b"sv, "ni"sv}) {
+        assert(!stop_words.Contains(word));
+    }
+    assert(!stop_words.Contains(std::string(64, 'x')));
+    assert(!stop_words.Contains(std::string(70, 'y')));
+    assert(!stop_words.Contains(std::string(69, 'x') + "y"s));
+
+    for (const StopWordSet& empty_stop_words : {StopWordSet(), StopWordSet(std::vector<std::string>{})}) {
+        assert(!empty_stop_words.Contains(""sv) && !empty_stop_words.Contains("a"sv));
+        assert(empty_stop_words.begin() == empty_stop_words.end());
+    }
+    // Equal words have equal hashes with every seed
+    AssertThrowsInvalidArgument([] {
+        StopWordSet({"cat"s, "dog"s, "cat"s});
+    });
+
+    SearchServer search_server(""s);
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "cat bird"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(3, "fish"s, DocumentStatus::ACTUAL, {1});
+    for (const std::string& query : {"--cat"s, "cat -"s, "-"s, "cat\x12"s, "-do\x01g"s}) {
+        AssertThrowsInvalidArgument([&search_server, &query] {
+            search_server.FindTopDocuments(query);
+        });
+    }
+
+    // Repeated plus and minus words count once
+    const std::string query = "cat dog cat dog -bird -bird"s;
+    const SearchServer::BatchMatch batch = search_server.MatchDocuments(query, {1, 2});
+    assert((batch.words == std::vector<std::string_view>{"cat"sv, "dog"sv}));
+    assert(batch.matched_counts == (std::vector<int>{2, 0}));
+    const std::vector<Document> repeated = search_server.FindTopDocuments(query);
+    const std::vector<Document> single = search_server.FindTopDocuments("cat dog -bird"s);
+    assert(repeated.size() == 1 && single.size() == 1 && repeated[0].id == 1);
+    assert(std::abs(repeated[0].relevance - single[0].relevance) < 1e-9);
+
+    std::cout << "TestStopWordsAndQueryParsing OK"s << std::endl;
+}
+
+void TestQueryExpansion() {
+    // Prefix expansions are the first MAX_EXPANDED_WORDS words in lexicographical order
+    SearchServer prefix_server("and"s);
+    std::string all_words;
+    std::vector<std::string> expected_words;
+    for (int i = 0; i < 40; ++i) {
+        const std::string word = "cat"s + (i < 10 ? "0"s : ""s) + std::to_string(i);
+        all_words += word + " "s;
+        if (i < MAX_EXPANDED_WORDS) {
+            expected_words.push_back(word);
+        }
+        prefix_server.AddDocument(100 + i, "dog "s + word, DocumentStatus::ACTUAL, {1});
+    }
+    prefix_server.AddDocument(1, all_words, DocumentStatus::ACTUAL, {1});
+    prefix_server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, {1});
+    const std::string prefix_query = "cat*"s;
+    const auto [prefix_words, prefix_status] = prefix_server.MatchDocument(prefix_query, 1);
+    assert(std::vector<std::string>(prefix_words.begin(), prefix_words.end()) == expected_words);
+    // A minus word excludes every expansion, not only the first ones
+    assert(GetDocumentIds(prefix_server.FindTopDocuments("dog -cat*"s)) == std::vector<int>{2});
+
+    // Every word within one edit excludes a document, however many of them there are
+    SearchServer fuzzy_server("and"s);
+    fuzzy_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {1});
+    fuzzy_server.AddDocument(2, "cot"s, DocumentStatus::ACTUAL, {1});
+    fuzzy_server.AddDocument(3, "dog"s, DocumentStatus::ACTUAL, {1});
+    for (char letter = 'a'; letter <= 'z'; ++letter) {
+        fuzzy_server.AddDocument(10 + letter - 'a', "dog ca"s + letter, DocumentStatus::ACTUAL, {1});
+        fuzzy_server.AddDocument(40 + letter - 'a', "dog cat"s + letter, DocumentStatus::ACTUAL, {1});
+    }
+    assert(GetDocumentIds(fuzzy_server.FindTopDocuments("dog -cat~"s)) == std::vector<int>{3});
+
+    // The exact word beats a typo, which gets FUZZY_EDIT_WEIGHT of the relevance
+    fuzzy_server.RemoveDocument(3);
+    for (char letter = 'a'; letter <= 'z'; ++letter) {
+        fuzzy_server.RemoveDocument(10 + letter - 'a');
+        fuzzy_server.RemoveDocument(40 + letter - 'a');
+    }
+    const std::vector<Document> fuzzy_documents = fuzzy_server.FindTopDocuments("cat~"s);
+    assert(fuzzy_documents.size() == 2 && fuzzy_documents[0].id == 1 && fuzzy_documents[1].id == 2);
+    assert(std::abs(fuzzy_documents[1].relevance - FUZZY_EDIT_WEIGHT * fuzzy_documents[0].relevance) < 1e-6);
+
+    SearchServer search_server("and"s, WordPositions::STORE);
+    search_server.AddDocument(1, "cat dog"s, DocumentStatus::ACTUAL, {1});
+    AssertThrowsInvalidArgument([&search_server] {
+        search_server.FindTopDocuments("cat~"s + std::to_string(MAX_EDIT_DISTANCE + 1));
+    });
+    AssertThrowsInvalidArgument([&search_server] {
+        search_server.FindTopDocuments("\"cat* dog\""s);
+    });
+
+    // A word both plain and expanded counts once for proximity, even where
+    // every relevance is zero in a one-document index
+    for (const std::string& query : {"cat cat*"s, "ca* cat~"s, "cat cat~0"s, "cat dog*"s}) {
+        const std::vector<Document> documents = search_server.FindTopDocuments(query);
+        assert(documents.size() == 1 && std::isfinite(documents[0].relevance));
+    }
+    search_server.AddDocument(2, "bird fish"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(3, "cat fish big"s, DocumentStatus::ACTUAL, {1});
+    for (const std::string& query : {"cat cat*"s, "ca* cat~"s, "cat cat~0"s}) {
+        const std::vector<Document> documents = search_server.FindTopDocuments(query);
+        assert((GetDocumentIds(documents) == std::vector<int>{1, 3}));
+        for (const Document& document : documents) {
+            assert(std::isfinite(document.relevance));
+        }
+    }
+
+    std::cout << "TestQueryExpansion OK"s << std::endl;
+}
+
+void TestThreadPool() {
+    ThreadPool pool(3);
+    // Exceptions of loop bodies reach the caller and leave the pool usable
+    try {
+        pool.ParallelFor(1000, 1, [](size_t index, size_t) {
+            if (index == 500) {
+                throw std::runtime_error("loop body"s);
+            }
+        });
+        assert(!"std::runtime_error expected");
+    } catch (const std::runtime_error&) {
+    }
+    std::vector<int> visits(1000);
+    pool.ParallelFor(visits.size(), 1, [&visits](size_t index, size_t) {
+        ++visits[index];
+    });
+    assert(std::all_of(visits.begin(), visits.end(), [](int count) {
+        return count == 1;
+    }));
+
+    // Enough postings for the queries to run on the pool
+    SearchServer search_server("and"s);
+    std::mt19937 generator(5);
+    std::uniform_int_distribution<int> word_index(0, 19);
+    for (int document_id = 0; document_id < 3 * static_cast<int>(POSTINGS_GRAIN_SIZE); ++document_id) {
+        std::string document;
+        for (int i = 0; i < 8; ++i) {
+            document += "w"s + std::to_string(word_index(generator)) + " "s;
+        }
+        const DocumentStatus status = document_id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(document_id, document, status, {document_id % 5});
+    }
+    ThreadPool single_pool(1);
+    const auto check_queries = [&search_server](ThreadPool& checked_pool) {
+        for (const std::string& query : {"w1 w2 w3"s, "w1 w2 -w3"s, "w1* w5"s, "w12~ -w4"s, "w2* w2 w20~"s}) {
+            const auto check = [](const std::vector<Document>& pool_documents,
+                                  const std::vector<Document>& documents) {
+                assert(pool_documents.size() == documents.size());
+                for (size_t i = 0; i < documents.size(); ++i) {
+                    assert(pool_documents[i].id == documents[i].id);
+                    assert(std::abs(pool_documents[i].relevance - documents[i].relevance) < 1e-9);
+                }
+            };
+            check(search_server.FindTopDocuments(checked_pool, query), search_server.FindTopDocuments(query));
+            check(search_server.FindTopDocuments(checked_pool, query, DocumentStatus::BANNED),
+                  search_server.FindTopDocuments(query, DocumentStatus::BANNED));
+        }
+    };
+    // Scratch buffers are reused by the next queries and pools of another size
+    check_queries(pool);
+    check_queries(single_pool);
+    check_queries(pool);
+
+    // An exception thrown by a predicate on a pool thread reaches the caller
+    try {
+        search_server.FindTopDocuments(pool, "w1 w2 w3"s, [](int document_id, DocumentStatus, int) {
+            if (static_cast<size_t>(document_id) >= POSTINGS_GRAIN_SIZE) {
+                throw std::runtime_error("predicate"s);
+            }
+            return true;
+        });
+        assert(!"std::runtime_error expected");
+    } catch (const std::runtime_error&) {
+    }
+    check_queries(pool);
+
+    std::cout << "TestThreadPool OK"s << std::endl;
+}
+
+void TestMatchDocuments() {
+    SearchServer search_server("and"s, WordPositions::STORE);
+    search_server.AddDocument(1, "white cat and collar"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(2, "black dog"s, DocumentStatus::BANNED, {1});
+    search_server.AddDocument(3, "white dog fluffy tail"s, DocumentStatus::ACTUAL, {1});
+    search_server.AddDocument(4, "cat white"s, DocumentStatus::ACTUAL, {1});
+    const std::vector<int> document_ids = {4, 3, 2, 1};
+    ThreadPool pool(2);
+
+    // Words missing from the index are dropped, the rest are sorted
+    const std::string query = "white cat dog unknown -fluffy"s;
+    const SearchServer::BatchMatch batch = search_server.MatchDocuments(query, document_ids);
+    assert((batch.words == std::vector<std::string_view>{"cat"sv, "dog"sv, "white"sv}));
+    assert(batch.matched_counts == (std::vector<int>{2, 0, 1, 2}));
+    assert(batch.matched_word_indices.size() == document_ids.size() * batch.words.size());
+    // Rows have a stride of words.size(), only the first matched_counts[i] entries are used
+    const size_t stride = batch.words.size();
+    assert(batch.matched_word_indices[0] == 0 && batch.matched_word_indices[1] == 2);
+    assert(batch.matched_word_indices[2 * stride] == 1);
+    assert(batch.matched_word_indices[3 * stride] == 0 && batch.matched_word_indices[3 * stride + 1] == 2);
+    assert(batch.statuses[2] == DocumentStatus::BANNED);
+
+    // A document without the phrase matches nothing
+    const std::string phrase_query = "\"white cat\" dog"s;
+    const SearchServer::BatchMatch phrase_batch = search_server.MatchDocuments(phrase_query, document_ids);
+    assert(phrase_batch.matched_counts == (std::vector<int>{0, 0, 0, 2}));
+
+    for (const std::string& checked_query : {query, phrase_query, "cat* -dog"s}) {
+        const auto check = [&](const SearchServer::BatchMatch& result, const auto& match_document) {
+            for (size_t i = 0; i < document_ids.size(); ++i) {
+                const auto [words, status] = match_document(document_ids[i]);
+                std::vector<std::string_view> batch_words;
+                for (int j = 0; j < result.matched_counts[i]; ++j) {
+                    batch_words.push_back(result.words[result.matched_word_indices[i * result.words.size() + j]]);
+                }
+                assert(batch_words == words && result.statuses[i] == status);
+            }
+        };
+        check(search_server.MatchDocuments(checked_query, document_ids), [&](int document_id) {
+            return search_server.MatchDocument(checked_query, document_id);
+        });
+        check(search_server.MatchDocuments(std::execution::par, checked_query, document_ids), [&](int document_id) {
+            return search_server.MatchDocument(std::execution::par, checked_query, document_id);
+        });
+        check(search_server.MatchDocuments(pool, checked_query, document_ids), [&](int document_id) {
+            return search_server.MatchDocument(pool, checked_query, document_id);
+        });
+    }
+
+    // Ids are checked before the query is parsed
+    try {
+        search_server.MatchDocuments("--cat"s, {1, 5});
+        assert(!"std::out_of_range expected");
+    } catch (const std::out_of_range&) {
+    }
+
+    std::cout << "TestMatchDocuments OK"s << std::endl;
+}
+
+void TestSegmentsKeepLiveDocuments() {
+    SearchServer search_server("and"s);
+    ThreadPool pool(2);
+    std::vector<bool> is_live;
+    const auto add_document = [&](int document_id, const std::string& document) {
+        search_server.AddDocument(document_id, document, DocumentStatus::ACTUAL, {1});
+        if (document_id >= static_cast<int>(is_live.size())) {
+            is_live.resize(document_id + 1);
+        }
+        is_live[document_id] = true;
+    };
+
+    // All the documents but the last half a segment are sealed
+    const int document_count = SEGMENT_DOCUMENT_COUNT * SEGMENT_MERGE_FACTOR + SEGMENT_DOCUMENT_COUNT / 2;
+    for (int document_id = 0; document_id < document_count; ++document_id) {
+        add_document(document_id, MakeTestDocument(document_id));
+    }
+    CheckLiveDocuments(search_server, pool, is_live);
+
+    // Half of the documents of every segment are removed, which is enough for a rewrite
+    for (int document_id = 0; document_id < document_count; document_id += 2) {
+        switch (document_id / 2 % 3) {
+        case 0:
+            search_server.RemoveDocument(document_id);
+            break;
+        case 1:
+            search_server.RemoveDocument(std::execution::par, document_id);
+            break;
+        default:
+            search_server.RemoveDocument(pool, document_id);
+        }
+        is_live[document_id] = false;
+    }
+    CheckLiveDocuments(search_server, pool, is_live);
+    // Words without documents are not found, not even by expansions
+    assert(search_server.FindTopDocuments("even"s).empty());
+    assert(search_server.FindTopDocuments("eve*"s).empty());
+    assert(search_server.FindTopDocuments("evem~"s).empty());
+
+    // Ids come back with other words, so stale postings of the removed documents must not match
+    for (int document_id = 0; document_id < document_count; document_id += 4) {
+        add_document(document_id, "again id"s + std::to_string(document_id));
+    }
+    CheckLiveDocuments(search_server, pool, is_live);
+    assert(search_server.FindTopDocuments("even"s).empty());
+    const std::string match_query = "even again"s;
+    const auto [matched_words, status] = search_server.MatchDocument(match_query, 0);
+    assert(matched_words == std::vector<std::string_view>{"again"sv});
+
+    // Adding across the sealing threshold seals the documents added again and merges segments
+    for (int document_id = document_count; document_id < document_count + 2 * SEGMENT_DOCUMENT_COUNT; ++document_id) {
+        add_document(document_id, MakeTestDocument(document_id));
+    }
+    CheckLiveDocuments(search_server, pool, is_live);
+    const std::vector<Document> even_documents = search_server.FindTopDocuments("even"s);
+    assert(!even_documents.empty());
+    for (const Document& document : even_documents) {
+        assert(document.id >= document_count && document.id % 2 == 0);
+    }
+
+    std::cout << "TestSegmentsKeepLiveDocuments OK"s << std::endl;
+}
+
+void BenchmarkSegmentsIngest(int document_count) {
+    std::mt19937 generator(42);
+
+    std::vector<std::string> words(10000);
+    for (std::string& word : words) {
+        const int length = std::uniform_int_distribution<int>(3, 8)(generator);
+        for (int i = 0; i < length; ++i) {
+            word.push_back(static_cast<char>('a' + std::uniform_int_distribution<int>(0, 25)(generator)));
+        }
+    }
+    // Low indices are picked more often, so that some words are common
+    const auto pick_word = [&]() -> const std::string& {
+        std::uniform_int_distribution<size_t> index(0, words.size() - 1);
+        return words[std::min(index(generator), index(generator))];
+    };
+    const auto make_document = [&] {
+        std::string document;
+        const int word_count = std::uniform_int_distribution<int>(10, 30)(generator);
+        for (int i = 0; i < word_count; ++i) {
+            document += pick_word() + " "s;
+        }
+        return document;
+    };
+    std::vector<std::string> queries(100);
+    for (std::string& query : queries) {
+        query = pick_word() + " "s + pick_word() + " "s + pick_word() + " -"s + pick_word();
+    }
+
+    SearchServer search_server("and in on"s);
+    std::vector<double> add_latencies;
+    std::vector<double> latencies;
+    const Clock::time_point start = Clock::now();
+    for (int document_id = 0; document_id < document_count; ++document_id) {
+        const std::string document = make_document();
+        const Clock::time_point add_start = Clock::now();
+        search_server.AddDocument(document_id, document, DocumentStatus::ACTUAL, {1});
+        add_latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - add_start).count());
+        // Every tenth step replaces one of the documents added before
+        if (document_id % 10 == 9) {
+            const int replaced_id = std::uniform_int_distribution<int>(0, document_id)(generator);
+            search_server.RemoveDocument(replaced_id);
+            search_server.AddDocument(replaced_id, make_document(), DocumentStatus::ACTUAL, {1});
+        }
+        if (document_id % 100 == 0) {
+            const Clock::time_point query_start = Clock::now();
+            search_server.FindTopDocuments(queries[document_id / 100 % queries.size()]);
+            latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - query_start).count());
+        }
+    }
+    const double ingest_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::cout << "Segments ingest: "s << document_count << " documents, "s
+              << static_cast<int>(document_count / ingest_seconds) << " documents/s"s << std::endl;
+    std::cout << "AddDocument latency, ms: p50 "s << GetPercentile(add_latencies, 0.5)
+              << ", p99 "s << GetPercentile(add_latencies, 0.99)
+              << ", max "s << GetPercentile(add_latencies, 1.0) << std::endl;
+    std::cout << "Query latency between additions, ms: p50 "s << GetPercentile(latencies, 0.5)
+              << ", p99 "s << GetPercentile(latencies, 0.99)
+              << ", max "s << GetPercentile(latencies, 1.0) << std::endl;
+}
+
+void BenchmarkQueryTailLatency(int document_count, size_t thread_count) {
+    std::mt19937 generator(11);
+
+    std::vector<std::string> words(20000);
+    for (std::string& word : words) {
+        const int length = std::uniform_int_distribution<int>(3, 8)(generator);
+        for (int i = 0; i < length; ++i) {
+            word.push_back(static_cast<char>('a' + std::uniform_int_distribution<int>(0, 25)(generator)));
+        }
+    }
+    std::uniform_int_distribution<size_t> word_index(0, words.size() - 1);
+
+    SearchServer search_server("and in on"s);
+    for (int document_id = 0; document_id < document_count; ++document_id) {
+        std::string document;
+        const int word_count = std::uniform_int_distribution<int>(10, 40)(generator);
+        for (int i = 0; i < word_count; ++i) {
+            // Low indices are picked much more often, so that some words are in most documents
+            document += words[std::min({word_index(generator), word_index(generator), word_index(generator)})] + " "s;
+        }
+        search_server.AddDocument(document_id, document, DocumentStatus::ACTUAL, {1});
+    }
+
+    // Every tenth query is a large one
+    std::vector<std::string> queries(2000);
+    for (size_t i = 0; i < queries.size(); ++i) {
+        if (i % 10 == 0) {
+            for (int k = 0; k < 8; ++k) {
+                queries[i] += words[word_index(generator) % 20] + " "s;
+            }
+            queries[i] += "-"s + words[word_index(generator) % 2000];
+        } else {
+            for (int k = 0; k < 3; ++k) {
+                queries[i] += words[5000 + word_index(generator) % 15000] + " "s;
+            }
+        }
+    }
+
+    ThreadPool pool(thread_count, ThreadPinning::COMPACT);
+    const auto benchmark = [&queries](const std::string& name, const std::function<void(const std::string&)>& run) {
+        std::vector<double> small_latencies;
+        std::vector<double> large_latencies;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            const Clock::time_point start = Clock::now();
+            run(queries[i]);
+            (i % 10 == 0 ? large_latencies : small_latencies).push_back(
+                std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        }
+        std::cout << name << " small queries, us: p50 "s << GetPercentile(small_latencies, 0.5)
+                  << ", p99 "s << GetPercentile(small_latencies, 0.99)
+                  << ", max "s << GetPercentile(small_latencies, 1.0)
+                  << "; large queries, us: p50 "s << GetPercentile(large_latencies, 0.5)
+                  << ", p99 "s << GetPercentile(large_latencies, 0.99)
+                  << ", max "s << GetPercentile(large_latencies, 1.0) << std::endl;
+    };
+    benchmark("seq"s, [&search_server](const std::string& query) {
+        search_server.FindTopDocuments(std::execution::seq, query);
+    });
+    benchmark("par"s, [&search_server](const std::string& query) {
+        search_server.FindTopDocuments(std::execution::par, query);
+    });
+    benchmark("pool("s + std::to_string(thread_count) + ")"s, [&search_server, &pool](const std::string& query) {
+        search_server.FindTopDocuments(pool, query);
+    });
+}
+
+void BenchmarkWordPositions(int document_count) {
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> word_index(0, 5000);
+    const auto make_word = [&] {
+        return "w"s + std::to_string(word_index(generator));
+    };
+
+    std::vector<std::string> documents(document_count);
+    for (std::string& document : documents) {
+        for (int i = 0; i < 50; ++i) {
+            document += make_word() + " "s;
+        }
+    }
+    std::vector<std::string> queries(2000);
+    for (std::string& query : queries) {
+        query = make_word() + " "s + make_word() + " "s + make_word() + " -"s + make_word();
+    }
+    // The first two words of a document
+    std::vector<std::string> phrase_queries;
+    for (size_t i = 0; i < queries.size() && i < documents.size(); ++i) {
+        const size_t phrase_end = documents[i].find(' ', documents[i].find(' ') + 1);
+        phrase_queries.push_back("\""s + documents[i].substr(0, phrase_end) + "\""s);
+    }
+
+    for (const WordPositions word_positions : {WordPositions::DISCARD, WordPositions::STORE}) {
+        const std::string name = word_positions == WordPositions::STORE ? "STORE"s : "DISCARD"s;
+        const size_t allocated_before = GetAllocatedBytes();
+        SearchServer search_server("w1 w2"s, word_positions);
+        for (int document_id = 0; document_id < document_count; ++document_id) {
+            search_server.AddDocument(document_id, documents[document_id], DocumentStatus::ACTUAL, {1});
+        }
+        std::cout << name << " index: "s << (GetAllocatedBytes() - allocated_before) / 1024 / 1024
+                  << " MiB"s << std::endl;
+        {
+            LOG_DURATION_STREAM(name + " 2000 plain queries"s, std::cout);
+            for (const std::string& query : queries) {
+                search_server.FindTopDocuments(query);
+            }
+        }
+        if (word_positions == WordPositions::STORE) {
+            LOG_DURATION_STREAM(name + " "s + std::to_string(phrase_queries.size()) + " phrase queries"s, std::cout);
+            for (const std::string& query : phrase_queries) {
+                search_server.FindTopDocuments(query);
+            }
+        }
+    }
+}
+
+void BenchmarkMatchDocuments(int document_count, size_t thread_count) {
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> word_index(0, 5000);
+    const auto make_word = [&] {
+        return "w"s + std::to_string(word_index(generator));
+    };
+
+    SearchServer search_server("w1 w2"s);
+    for (int document_id = 0; document_id < document_count; ++document_id) {
+        std::string document;
+        for (int i = 0; i < 50; ++i) {
+            document += make_word() + " "s;
+        }
+        search_server.AddDocument(document_id, document, DocumentStatus::ACTUAL, {1});
+    }
+    std::vector<std::string> queries(500);
+    for (std::string& query : queries) {
+        for (int i = 0; i < 8; ++i) {
+            query += make_word() + " "s;
+        }
+        query += "-"s + make_word();
+    }
+    std::vector<int> document_ids;
+    for (int i = 0; i < 200; ++i) {
+        document_ids.push_back(i * document_count / 200);
+    }
+
+    ThreadPool pool(thread_count);
+    const std::string suffix = " x "s + std::to_string(document_ids.size()) + " documents"s;
+    size_t matched_count = 0;
+    const auto match_one_by_one = [&](const std::string& name, const auto& match_document) {
+        LOG_DURATION_STREAM("MatchDocument "s + name + ", "s + std::to_string(queries.size()) + " queries"s + suffix,
+                            std::cout);
+        for (const std::string& query : queries) {
+            for (const int document_id : document_ids) {
+                matched_count += std::get<0>(match_document(query, document_id)).size();
+            }
+        }
+    };
+    const auto match_batch = [&](const std::string& name, const auto& match_documents) {
+        LOG_DURATION_STREAM("MatchDocuments "s + name + ", "s + std::to_string(queries.size()) + " queries"s + suffix,
+                            std::cout);
+        for (const std::string& query : queries) {
+            for (const int count : match_documents(query).matched_counts) {
+                matched_count += count;
+            }
+        }
+    };
+    match_one_by_one("seq"s, [&](const std::string& query, int document_id) {
+        return search_server.MatchDocument(query, document_id);
+    });
+    match_one_by_one("par"s, [&](const std::string& query, int document_id) {
+        return search_server.MatchDocument(std::execution::par, query, document_id);
+    });
+    match_batch("seq"s, [&](const std::string& query) {
+        return search_server.MatchDocuments(query, document_ids);
+    });
+    match_batch("par"s, [&](const std::string& query) {
+        return search_server.MatchDocuments(std::execution::par, query, document_ids);
+    });
+    match_batch("pool"s, [&](const std::string& query) {
+        return search_server.MatchDocuments(pool, query, document_ids);
+    });
+    // Keeps the matching from being optimized away
+    std::cout << "Matched words: "s << matched_count << std::endl;
+}
@@ -1 +1,52 @@
-#pragma once
\ No newline at end of file
+#pragma once
+
+#include "search_server.h"
+
+// Removes documents from sealed and mutable segments, adds some of them again
+// under the same ids and goes on adding documents across the sealing
+// threshold, checking after every step that queries see exactly the live ones
+void TestSegmentsKeepLiveDocuments();
+
+// Checks phrase queries against stop words, word order, malformed queries,
+// sealed segments and documents added again, and that proximity puts
+// documents with adjacent query words first
+void TestPhrasesAndProximity();
+
+// Checks stop word lookups of members and non-members of every length, empty
+// and malformed stop word sets, malformed query words and repeated query words
+void TestStopWordsAndQueryParsing();
+
+// Checks the order and the cap of prefix expansions, that minus words exclude
+// every expansion, fuzzy weighting, malformed expandable words and words both
+// plain and expanded
+void TestQueryExpansion();
+
+// Checks that exceptions of loop bodies reach the caller of ParallelFor and
+// that ThreadPool queries, expanded words included, find what sequential ones do
+void TestThreadPool();
+
+// Checks the layout of BatchMatch, the rejection of documents by minus words
+// and phrases, and that every executor matches like MatchDocument
+void TestMatchDocuments();
+
+// Matches queries against a batch of documents one document at a time and in
+// one MatchDocuments call, with the policies and a ThreadPool of thread_count
+// threads, and prints the time of each way
+void BenchmarkMatchDocuments(int document_count, size_t thread_count);
+
+// Adds document_count random documents with word positions discarded and
+// stored, and prints the index memory (where the allocator reports it) and the
+// time of plain and phrase queries
+void BenchmarkWordPositions(int document_count);
+
+// Adds document_count random documents, removing and adding again some of them
+// on the way, and prints the ingest rate and the latency percentiles of the
+// additions and of the queries issued between them on the same thread. Writes
+// and queries don't overlap, so this shows how sealing and merging stall both
+void BenchmarkSegmentsIngest(int document_count);
+
+// Runs a mix of many small queries over rare words and a few large ones over
+// frequent words with the sequential and parallel policies and with a
+// ThreadPool of thread_count threads, and prints the latency percentiles of
+// both kinds of queries for each of them
+void BenchmarkQueryTailLatency(int document_count, size_t thread_count);
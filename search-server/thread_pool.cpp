@@ -0,0 +1,200 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Pool and worker index of the current thread, if it is a pool thread
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_worker_index = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t thread_count, ThreadPinning pinning) {
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_[i]->thread = std::thread([this, i] {
+            WorkerThread(i);
+        });
+        if (pinning == ThreadPinning::COMPACT) {
+            PinThread(workers_[i]->thread, i);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    has_chunks_.notify_all();
+    for (const auto& worker : workers_) {
+        worker->thread.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size();
+}
+
+size_t ThreadPool::GetWorkerCount() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::RunLoop(size_t count, size_t grain_size, const RangeBody& body) {
+    if (count == 0) {
+        return;
+    }
+    // A pool thread waiting for a nested loop could leave no one to run it
+    if (workers_.empty() || count <= grain_size || current_pool == this) {
+        body(0, count, current_pool == this ? current_worker_index : workers_.size());
+        return;
+    }
+
+    const size_t thread_count = workers_.size();
+    const size_t min_chunk_count = thread_count * CHUNKS_PER_THREAD;
+    const size_t chunk_size = std::max(grain_size, (count + min_chunk_count - 1) / min_chunk_count);
+    const size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+
+    Loop loop;
+    loop.body = &body;
+    loop.pending_chunk_count = chunk_count;
+
+    {
+        // The count goes up before a chunk can be taken and decrement it, and
+        // idle workers see it only once all the chunks are queued
+        std::lock_guard pool_lock(mutex_);
+        queued_chunk_count_ += chunk_count;
+
+        // Neighbouring chunks go to the same worker, which runs them one after another
+        for (size_t worker_index = 0; worker_index < thread_count; ++worker_index) {
+            const size_t first_chunk = chunk_count * worker_index / thread_count;
+            const size_t last_chunk = chunk_count * (worker_index + 1) / thread_count;
+            Worker& worker = *workers_[worker_index];
+            std::lock_guard lock(worker.mutex);
+            for (size_t chunk = first_chunk; chunk < last_chunk; ++chunk) {
+                worker.chunks.push_back({&loop, chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size)});
+            }
+        }
+    }
+    has_chunks_.notify_all();
+
+    // The calling thread runs only the chunks of its own loop: its worker index
+    // is shared with the other threads calling the pool
+    Chunk chunk;
+    while (loop.pending_chunk_count > 0 && TakeChunk(thread_count, &loop, chunk)) {
+        RunChunk(chunk, thread_count);
+    }
+
+    std::unique_lock lock(loop.mutex);
+    loop.done.wait(lock, [&loop] {
+        return loop.pending_chunk_count == 0;
+    });
+    if (loop.exception) {
+        std::rethrow_exception(loop.exception);
+    }
+}
+
+void ThreadPool::WorkerThread(size_t worker_index) {
+    current_pool = this;
+    current_worker_index = worker_index;
+
+    Chunk chunk;
+    while (true) {
+        if (TakeChunk(worker_index, nullptr, chunk)) {
+            RunChunk(chunk, worker_index);
+            continue;
+        }
+        std::unique_lock lock(mutex_);
+        has_chunks_.wait(lock, [this] {
+            return is_stopping_ || queued_chunk_count_ > 0;
+        });
+        if (is_stopping_ && queued_chunk_count_ == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::TakeChunk(size_t worker_index, const Loop* loop, Chunk& chunk) {
+    const size_t thread_count = workers_.size();
+    for (size_t step = 0; step < thread_count; ++step) {
+        const size_t victim_index = (worker_index + step) % thread_count;
+        Worker& victim = *workers_[victim_index];
+        std::lock_guard lock(victim.mutex);
+        if (loop != nullptr) {
+            const auto it = std::find_if(victim.chunks.begin(), victim.chunks.end(), [loop](const Chunk& other) {
+                return other.loop == loop;
+            });
+            if (it == victim.chunks.end()) {
+                continue;
+            }
+            chunk = *it;
+            victim.chunks.erase(it);
+        } else if (victim.chunks.empty()) {
+            continue;
+        } else if (victim_index == worker_index) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+        } else {
+            chunk = victim.chunks.front();
+            victim.chunks.pop_front();
+        }
+        --queued_chunk_count_;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::RunChunk(const Chunk& chunk, size_t worker_index) {
+    Loop& loop = *chunk.loop;
+    try {
+        (*loop.body)(chunk.first, chunk.last, worker_index);
+    } catch (...) {
+        std::lock_guard lock(loop.mutex);
+        if (!loop.exception) {
+            loop.exception = std::current_exception();
+        }
+    }
+
+    // The loop lives on the stack of its caller, which may return as soon as
+    // it sees no pending chunks, so the last chunk is counted under the lock
+    std::lock_guard lock(loop.mutex);
+    if (--loop.pending_chunk_count == 0) {
+        loop.done.notify_all();
+    }
+}
+
+void ThreadPool::PinThread(std::thread& thread, size_t index) {
+#ifdef __linux__
+    cpu_set_t allowed_cpus;
+    CPU_ZERO(&allowed_cpus);
+    if (sched_getaffinity(0, sizeof(allowed_cpus), &allowed_cpus) != 0) {
+        return;
+    }
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed_cpus)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) {
+        return;
+    }
+
+    // Pinning is a hint: the thread keeps running unpinned if it fails
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpus[index % cpus.size()], &cpu_set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set);
+#else
+    (void)thread;
+    (void)index;
+#endif
+}
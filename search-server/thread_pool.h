@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Placement of the pool threads on the CPUs the process may run on
+enum class ThreadPinning {
+    NONE,
+    // Worker i runs on the i-th allowed CPU only, so neighbouring workers share caches
+    COMPACT,
+};
+
+// Fixed set of worker threads running fork-join loops. A loop is cut into
+// chunks which are dealt out to per-worker deques in contiguous blocks. Every
+// worker pops its own chunks from the back and, once it runs out, steals from
+// the front of the other deques, the next workers first. The calling thread
+// works on the loop too instead of blocking.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count = std::thread::hardware_concurrency(),
+                        ThreadPinning pinning = ThreadPinning::NONE);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool();
+
+    size_t GetThreadCount() const;
+
+    // Worker indices passed to loop bodies are less than this, the calling thread has its own one
+    size_t GetWorkerCount() const;
+
+    // Calls body(index, worker_index) for every index in [0, count) and returns
+    // when all the calls are done, rethrowing the first exception thrown by body.
+    // A worker index is used by one thread at a time during the loop, so it may
+    // select per-worker scratch memory. Loops of at most grain_size indices, and
+    // loops started from the pool threads, run in the calling thread.
+    template <typename Body>
+    void ParallelFor(size_t count, size_t grain_size, Body body);
+
+private:
+    // Minimal number of chunks per thread: fewer chunks leave nothing to steal
+    static constexpr size_t CHUNKS_PER_THREAD = 4;
+
+    using RangeBody = std::function<void(size_t first, size_t last, size_t worker_index)>;
+
+    struct Loop {
+        const RangeBody* body;
+        std::atomic<size_t> pending_chunk_count;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr exception;
+    };
+
+    struct Chunk {
+        Loop* loop;
+        size_t first;
+        size_t last;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // Guards sleeping on has_chunks_ and queueing of chunks, taken before the worker mutexes
+    std::mutex mutex_;
+    std::condition_variable has_chunks_;
+    std::atomic<size_t> queued_chunk_count_ = 0;
+    bool is_stopping_ = false;
+
+    void RunLoop(size_t count, size_t grain_size, const RangeBody& body);
+
+    void WorkerThread(size_t worker_index);
+
+    // Takes a chunk from the own deque of the worker or steals one, the next workers first.
+    // With a loop given, only a chunk of this loop is taken
+    bool TakeChunk(size_t worker_index, const Loop* loop, Chunk& chunk);
+
+    void RunChunk(const Chunk& chunk, size_t worker_index);
+
+    static void PinThread(std::thread& thread, size_t index);
+};
+
+//===============TEMPLATES=================================
+
+template <typename Body>
+void ThreadPool::ParallelFor(size_t count, size_t grain_size, Body body) {
+    const RangeBody range_body = [&body](size_t first, size_t last, size_t worker_index) {
+        for (size_t index = first; index < last; ++index) {
+            body(index, worker_index);
+        }
+    };
+    RunLoop(count, grain_size, range_body);
+}